@@ -0,0 +1,112 @@
+/*
+ * relay.c - the relay builtin of shellex: a pipeline stage run by the
+ * shell itself that passes its input on without copying it through
+ * user space; and the descriptors here-documents are read from. Kept
+ * apart from shellex.c because splice, tee and memfd_create need
+ * _GNU_SOURCE, which csapp.h does not compile under.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define RELAY_CHUNK (1 << 20) /* Bytes moved per splice/tee call, and pipe size */
+
+int relay(char *file);
+int body_fd(char *data, size_t len);
+
+static ssize_t write_all(int fd, char *buf, size_t n)
+{
+    size_t left = n;
+    ssize_t k;
+
+    while (left > 0) {
+        if ((k = write(fd, buf, left)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += k;
+        left -= k;
+    }
+    return n;
+}
+
+/*
+ * relay - copy standard input to standard output, and to file if it is
+ * not NULL, for a shell stage that sits between two commands. Between
+ * pipes the data never enters user space: tee(2) duplicates it into the
+ * output pipe, splice(2) moves it on to the file. Anything else falls
+ * back to read and write.
+ */
+int relay(char *file)
+{
+    static char buf[RELAY_CHUNK];
+    ssize_t n, m, k;
+    int fd = -1;
+
+    if (file != NULL && (fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        fprintf(stderr, "relay: %s: %s\n", file, strerror(errno));
+        return -1;
+    }
+    /* Bigger pipes mean fewer calls; without the privilege to grow them, 64K it is */
+    fcntl(STDIN_FILENO, F_SETPIPE_SZ, RELAY_CHUNK);
+    fcntl(STDOUT_FILENO, F_SETPIPE_SZ, RELAY_CHUNK);
+    for (;;) {
+        if (fd < 0)
+            n = splice(STDIN_FILENO, NULL, STDOUT_FILENO, NULL, RELAY_CHUNK, SPLICE_F_MOVE);
+        else
+            n = tee(STDIN_FILENO, STDOUT_FILENO, RELAY_CHUNK, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        for (m = 0; fd >= 0 && m < n; m += k)
+            if ((k = splice(STDIN_FILENO, NULL, fd, NULL, n - m, SPLICE_F_MOVE)) <= 0)
+                goto out;
+    }
+    if (n < 0 && errno == EINVAL) { /* Not a pipe at one end */
+        while ((n = read(STDIN_FILENO, buf, sizeof(buf))) > 0) {
+            if (write_all(STDOUT_FILENO, buf, n) < 0)
+                break;
+            if (fd >= 0 && write_all(fd, buf, n) < 0)
+                break;
+        }
+    }
+out:
+    if (fd >= 0)
+        close(fd);
+    return n < 0 ? -1 : 0;
+}
+
+/*
+ * body_fd - a close-on-exec descriptor to read data[0..len) from, for a
+ * here-document: the read end of a pipe that already holds it, or if
+ * it does not fit in the pipe, a memfd. Either way it stays in memory.
+ * Returns -1 on error.
+ */
+int body_fd(char *data, size_t len)
+{
+    int fds[2], fd;
+
+    if (pipe2(fds, O_CLOEXEC) < 0)
+        return -1;
+    /* Nobody reads it yet, so no more than the pipe holds can be written */
+    if ((long)len <= fcntl(fds[1], F_GETPIPE_SZ)) {
+        write_all(fds[1], data, len);
+        close(fds[1]);
+        return fds[0];
+    }
+    close(fds[0]);
+    close(fds[1]);
+    if ((fd = memfd_create("here-document", MFD_CLOEXEC)) < 0)
+        return -1;
+    if (write_all(fd, data, len) < 0 || lseek(fd, 0, SEEK_SET) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
@@ -1,19 +1,182 @@
 /* $begin shellmain */
 #include "csapp.h"
 #include<errno.h>
-#define MAXARGS   128
+#include<spawn.h>
+#include<fcntl.h>
+#include<sys/mman.h>
+#include<sys/resource.h>
+#include<fnmatch.h>
+#include<glob.h>
+#include<sys/sendfile.h>
+#define MAXARGS   1024 /* Words on a command line */
+#define MAXPROCS  128  /* Processes in a job: pipeline stages, parallel runs */
+#define MAXJOBS   16  /* Jobs at any one time */
+#define HASH_SIZE 64  /* Buckets in the command hash table */
+#define READ_BLOCK (1 << 16) /* Script input read at once from a pipe */
+#define TIME_BUCKETS 21 /* Wall time histogram: under 1 ms, 2 ms, ... 2^19 ms, and over */
+#define TIME_SLOWEST 5  /* Slowest jobs listed in the summary */
+#define ARENA_BLOCK (1 << 16) /* Arena the words of a command are built in */
+#define CACHE_MAGIC "shellex cache 1\n"
+#define CACHE_HEAD (sizeof(CACHE_MAGIC) - 1 + 25) /* Magic, "%3d %20zu\n": status, key length */
+
+/* Job states */
+#define UNDEF 0 /* Free slot */
+#define FG    1 /* Running in the foreground */
+#define BG    2 /* Running in the background */
+#define ST    3 /* Stopped: no process of the job is running */
+#define DONE  4 /* Ended in the background, not reported yet */
+
+/* States of the processes of a job */
+#define P_RUN  0
+#define P_STOP 1
+#define P_DONE 2
+
+#ifdef __GLIBC_PREREQ
+#if __GLIBC_PREREQ(2, 35)
+#define HAVE_TCSETPGRP_NP /* posix_spawn can hand the child the terminal */
+/* spawn.h declares it only for _GNU_SOURCE, which csapp.h does not compile under */
+extern int posix_spawn_file_actions_addtcsetpgrp_np(posix_spawn_file_actions_t *, int);
+#endif
+#endif
+
+/*
+ * A job is one command line: the processes of its pipeline, in a
+ * process group of their own when the shell has a terminal. The
+ * SIGCHLD handler updates state and pstate; everything else touches
+ * the table with SIGCHLD blocked.
+ */
+typedef struct job {
+    volatile sig_atomic_t state;
+    int jid;
+    pid_t pgid;                           /* Also the first process */
+    int nprocs;
+    pid_t pids[MAXPROCS];
+    volatile sig_atomic_t pstate[MAXPROCS];
+    volatile sig_atomic_t status[MAXPROCS]; /* Wait status once P_DONE */
+    char cmdline[MAXLINE];
+    int timed;                            /* Report its usage when it ends */
+    double start, end;                    /* Wall clock, now_sec() */
+    struct rusage usage;                  /* Of its processes reaped so far */
+} job_t;
+
+/* A block of the word arena; blocks beyond the first are freed after each command */
+typedef struct arena_block {
+    struct arena_block *next; /* The block before */
+    size_t size, used;
+    char data[];
+} arena_block_t;
+
+/* Command hash table entry: where PATH search found a command */
+typedef struct cmd_entry {
+    char *name;
+    char *path;
+    int hits;
+    struct cmd_entry *next;
+} cmd_entry_t;
 
 /* Function prototypes */
 void eval(char *cmdline);
-int parseline(char *buf, char **argv);
+void eval_buf(char *buf, char *cmdline);
+int run_file(int fd, int is_stdin);
+int run_script(char *script, size_t len, int fd);
+int run_stream(int fd);
+char *next_line(void);
+int parseline(char *buf, char ***argvp);
+int redir_len(char *s);
+char *expand_var(char *p, int quoted);
+void expand_glob(char *pat);
+int cache_begin(char **argv, int *io);
+void cache_end(job_t *job);
+int redirect(char **argv, int *io, int *opened, int *nopened);
+int here_doc(char *delim);
+void run_builtin(char **argv);
 int builtin_command(char **argv); 
+int is_builtin(char *name);
+int split_pipeline(char **argv, char ***cmds);
+pid_t spawn(char **argv, int *io, pid_t pgid, int fg);
+pid_t spawn_path(char *path, char **argv, int *io, pid_t pgid, int fg);
+pid_t fork_builtin(char **argv, int *io, int other, pid_t pgid, int fg);
+void child_signals(void);
+void init_shell(void);
+void sigchld_handler(int sig);
+void update_job(job_t *job);
+job_t *add_job(pid_t *pids, int n, int state, char *cmdline);
+job_t *find_job(char *spec);
+int free_jobs(void);
+void wait_fg(job_t *job, sigset_t *mask);
+void report_jobs(int all);
+void signal_job(job_t *job, int sig);
+void do_fgbg(char **argv);
+void do_kill(char **argv);
+void do_parallel(char **argv);
+char *fill_holes(char *dst, size_t size, char *tmpl, char *arg);
+static double now_sec(void);
+void add_usage(struct rusage *sum, struct rusage *ru);
+void time_job(char *cmdline, double wall, struct rusage *ru);
+void time_builtin(char **argv, char *cmdline);
+void time_summary(void);
+void do_time(char **argv);
+int relay(char *file); /* relay.c */
+int body_fd(char *data, size_t len); /* relay.c */
+char *find_command(char *name);
+void forget_command(char *name);
+void clear_commands(void);
+void print_commands(void);
 
-int main() 
+static cmd_entry_t *cmd_table[HASH_SIZE];
+static char *cmd_table_path; /* PATH the table was filled under */
+
+static job_t jobs[MAXJOBS];
+static int shell_terminal = -1; /* Terminal fd when interactive, else -1: no job control */
+static pid_t shell_pgid;
+static int interactive;   /* Prompt and report jobs: stdin is a terminal */
+static int last_status;   /* Of the last foreground job, like $? */
+static int timing;        /* time on: report every job, and a summary at exit */
+static int job_signals[] = { SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD };
+#define NUM_JOB_SIGNALS (sizeof(job_signals) / sizeof(job_signals[0]))
+
+static char ops[5 * MAXARGS]; /* Operator words of the command; see parseline */
+#define IS_OP(w) ((w) >= ops && (w) < ops + sizeof(ops))
+
+/* The script being run, where here-documents read their bodies from */
+static char *src_pos, *src_end; /* Unread text; both NULL when interactive */
+static char *src_buf;           /* run_stream's block buffer */
+static int src_fd = -1;         /* What run_stream refills src_buf from, until EOF */
+
+/*
+ * usage: shellex [-t] [-c command | file]
+ * Without arguments commands come from stdin, with a prompt only if it
+ * is a terminal. Scripts exit with the status of their last command.
+ * -t times every job, as "time on" does.
+ */
+int main(int argc, char **argv) 
 {
     char cmdline[MAXLINE]; /* Command line */
+    char *on[] = { "time", "on", NULL };
+    int fd;
+
+    if (argc > 1 && !strcmp(argv[1], "-t")) {
+        do_time(on);
+        argc--;
+        argv++;
+    }
+    interactive = argc == 1 && isatty(STDIN_FILENO);
+    init_shell();
+    if (argc > 2 && !strcmp(argv[1], "-c"))
+        return run_script(argv[2], strlen(argv[2]), -1);
+    if (argc > 1) {
+        if ((fd = open(argv[1], O_RDONLY | O_CLOEXEC)) < 0) {
+            fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+            exit(127);
+        }
+        return run_file(fd, 0);
+    }
+    if (!interactive)
+        return run_file(STDIN_FILENO, 1);
 
     while (1) {
 	/* Read */
+	report_jobs(0);
 	printf("> ");                   
 	fgets(cmdline, MAXLINE, stdin); 
 	if (feof(stdin))
@@ -23,37 +186,543 @@ int main()
 	eval(cmdline);
     } 
 }
+
+/*
+ * run_file - run the script in fd. A regular file is mapped and run in
+ * place; anything else is read in blocks. If the script is our stdin,
+ * commands that read stdin must see the lines after their own.
+ */
+int run_file(int fd, int is_stdin)
+{
+    struct stat st;
+    char *map;
+    int rc;
+
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+        return run_stream(fd);
+    if (st.st_size == 0)
+        return 0;
+    /* Private and writable: lines are cut in place, the file is untouched */
+    if ((map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+        return run_stream(fd);
+    rc = run_script(map, st.st_size, is_stdin ? fd : -1);
+    munmap(map, st.st_size);
+    return rc;
+}
+
+/*
+ * run_script - run each line of script[0..len) where it lies: the
+ * newline becomes the terminating null, so no line is copied. If fd is not -1 it is the script's
+ * descriptor shared with the commands: its offset is set past each
+ * line before the line runs, and lines a command read are skipped.
+ */
+int run_script(char *script, size_t len, int fd)
+{
+    char *line;
+    off_t off;
+
+    src_pos = script;
+    src_end = script + len;
+    src_fd = -1;
+    while ((line = next_line()) != NULL) {
+        if (fd >= 0)
+            lseek(fd, src_pos - script, SEEK_SET);
+        eval_buf(line, NULL);
+        report_jobs(0);
+        if (fd >= 0 && (off = lseek(fd, 0, SEEK_CUR)) > src_pos - script)
+            src_pos = script + off;
+    }
+    return last_status;
+}
+
+/* run_stream - run a script that cannot be mapped, a block at a time */
+int run_stream(int fd)
+{
+    char *line;
+
+    src_buf = src_pos = src_end = Malloc(READ_BLOCK + 1);
+    src_fd = fd;
+    while ((line = next_line()) != NULL) {
+        eval_buf(line, NULL); /* A here-document may refill the buffer; the words are apart */
+        report_jobs(0);
+    }
+    free(src_buf);
+    return last_status;
+}
+
+/*
+ * next_line - cut the next line of the script being run, reading more
+ * of it first if it comes from a pipe, or read a line from the
+ * terminal. Returns NULL at the end of the input.
+ */
+char *next_line(void)
+{
+    static char last[MAXLINE];
+    char *line, *nl;
+    size_t have;
+    ssize_t n;
+
+    if (src_end == NULL) { /* Interactive */
+        printf("> ");
+        if (fgets(last, MAXLINE, stdin) == NULL)
+            return NULL;
+        last[strcspn(last, "\n")] = '\0';
+        return last;
+    }
+    while ((nl = memchr(src_pos, '\n', src_end - src_pos)) == NULL && src_fd >= 0) {
+        have = src_end - src_pos;
+        if (have == READ_BLOCK) {
+            fprintf(stderr, "Line too long\n");
+            have = 0;
+        }
+        memmove(src_buf, src_end - have, have);
+        while ((n = read(src_fd, src_buf + have, READ_BLOCK - have)) < 0 && errno == EINTR)
+            ;
+        if (n <= 0)
+            src_fd = -1;
+        src_pos = src_buf;
+        src_end = src_buf + have + (n > 0 ? n : 0);
+    }
+    if (nl != NULL) {
+        *nl = '\0';
+        line = src_pos;
+        src_pos = nl + 1;
+        return line;
+    }
+    if (src_pos == src_end)
+        return NULL;
+    /* The last line has no newline and maybe no room for a null */
+    snprintf(last, sizeof(last), "%.*s", (int)(src_end - src_pos), src_pos);
+    src_pos = src_end;
+    return last;
+}
 /* $end shellmain */
   
 /* $begin eval */
 /* eval - Evaluate a command line */
 void eval(char *cmdline) 
 {
-    char *argv[MAXARGS]; /* Argument list execve() */
-    char buf[MAXLINE];   /* Holds modified command line */
+    eval_buf(cmdline, cmdline);
+}
+
+/*
+ * eval_buf - evaluate the command line in buf; its words are built
+ * apart, so buf is left as it is. cmdline is its text for job
+ * listings; if NULL, the text is rebuilt from the words, and only when
+ * a job is started.
+ */
+void eval_buf(char *buf, char *cmdline)
+{
+    char **argv;         /* Argument list execve() */
+    char text[MAXLINE], *w;
+    char **cmds[MAXARGS]; /* argv of each pipeline stage */
+    pid_t pids[MAXPROCS];
+    int io[3], fds[2];
+    int opened[MAXARGS]; /* Files a stage's redirections opened */
     int bg;              /* Should the job run in bg or fg? */
-    pid_t pid;           /* Process id */
+    int i, j, n, ncmds, in, nopened;
+    int timed = 0;       /* Prefixed with time */
+    int cached = 0;      /* Prefixed with cached */
+    double t0;
+    pid_t pid = -1;      /* Process id */
+    pid_t pgid;          /* Process group of the job, 0 until its first process */
+    sigset_t mask, prev;
+    job_t *job;
     
-    strcpy(buf, cmdline);
-    bg = parseline(buf, argv); 
+    bg = parseline(buf, &argv); 
     if (argv[0] == NULL)  
 	return;   /* Ignore empty lines */
-    if (!builtin_command(argv)) { //quit -> exit(0), & -> ignore, other -> run
-        if (execve(argv[0], argv, environ) < 0) {	//ex) /bin/ls ls -al &
-            printf("%s: Command not found.\n", argv[0]);
-            exit(0);
+    /* time cmd ... times the job; time alone, time on and time off are the builtin */
+    if (!strcmp(argv[0], "time") && argv[1] != NULL && strcmp(argv[1], "on") && strcmp(argv[1], "off")) {
+        timed = 1;
+        for (i = 0; (argv[i] = argv[i + 1]) != NULL; i++)
+            ;
+    }
+    /* cached cmd ...: replay the output of an earlier run with the same inputs */
+    if (argv[0] != NULL && !strcmp(argv[0], "cached")) {
+        cached = 1;
+        for (i = 0; (argv[i] = argv[i + 1]) != NULL; i++)
+            ;
+        if (argv[0] == NULL) {
+            printf("usage: cached cmd ...\n");
+            return;
         }
+    }
+    if ((ncmds = split_pipeline(argv, cmds)) < 0) {
+        printf("syntax error near '|'\n");
+        return;
+    }
+    if (ncmds > MAXPROCS) {
+        printf("Too many pipeline stages\n");
+        return;
+    }
+    if (cached && (ncmds > 1 || bg || is_builtin(argv[0]))) {
+        printf("cached: only a single foreground command\n");
+        return;
+    }
+    if (ncmds == 1 && is_builtin(argv[0])) { //quit -> exit(0), & -> ignore
+        if (timed)
+            time_builtin(argv, cmdline);
+        else
+            run_builtin(argv);
+        return;
+    }
 
-	/* Parent waits for foreground job to terminate */
-	if (!bg){ 
-	    int status;
-	}
-	else//when there is backgrount process!
-	    printf("%d %s", pid, cmdline);
+    /* The handler must not reap a process before its job is in the table */
+    Sigemptyset(&mask);
+    Sigaddset(&mask, SIGCHLD);
+    Sigprocmask(SIG_BLOCK, &mask, &prev);
+    if (!free_jobs()) {
+        printf("Too many jobs\n");
+        Sigprocmask(SIG_SETMASK, &prev, NULL);
+        return;
+    }
+
+    /* Start every stage before waiting for any; stage i reads what i-1 writes */
+    fflush(stdout); /* Our messages come before the commands' output */
+    t0 = now_sec();
+    in = STDIN_FILENO;
+    pgid = shell_terminal >= 0 ? 0 : -1;
+    for (i = n = 0; i < ncmds; i++) {
+        fds[0] = fds[1] = -1;
+        if (i < ncmds - 1) {
+            if (pipe(fds) < 0)
+                unix_error("pipe error");
+            fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+            fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+        }
+        io[0] = in;
+        io[1] = i < ncmds - 1 ? fds[1] : STDOUT_FILENO;
+        io[2] = STDERR_FILENO;
+        nopened = 0;
+        pid = -1;
+        if (redirect(cmds[i], io, opened, &nopened) < 0)
+            last_status = 1;
+        else if (cmds[i][0] == NULL) /* Only redirections: the files are made, nothing runs */
+            last_status = 0;
+        else if (cached && cache_begin(cmds[i], io) > 0)
+            ; /* Replayed; nothing runs */
+        else if (is_builtin(cmds[i][0]))
+            pid = fork_builtin(cmds[i], io, fds[0], pgid, !bg);
+        else if ((pid = spawn(cmds[i], io, pgid, !bg)) < 0) {	//ex) /bin/ls ls -al &
+            printf("%s: Command not found.\n", cmds[i][0]);
+            last_status = 127;
+        }
+        if (pid > 0) {
+            pids[n++] = pid;
+            if (pgid == 0)
+                pgid = pid;
+            if (pgid > 0)
+                setpgid(pid, pgid); /* The child did too; whichever runs first wins */
+        }
+        if (in != STDIN_FILENO)
+            close(in);
+        if (fds[1] >= 0)
+            close(fds[1]);
+        while (nopened > 0)
+            close(opened[--nopened]);
+        in = fds[0];
+    }
+
+    if (n > 0) {
+        if (cmdline == NULL) {
+            for (i = 0, w = text, *w = '\0'; i < ncmds; i++)
+                for (j = 0; cmds[i][j] != NULL && w < text + MAXLINE; j++)
+                    w += snprintf(w, text + MAXLINE - w, "%s%s", w == text ? "" : j ? " " : " | ",
+                                  cmds[i][j]);
+            cmdline = text;
+        }
+        job = add_job(pids, n, bg ? BG : FG, cmdline);
+        job->timed = timed || timing;
+        job->start = t0;
+        /* Parent waits for foreground job to terminate */
+        if (!bg)
+            wait_fg(job, &prev);
+        else//when there is backgrount process!
+            printf("[%d] %d\n", job->jid, pids[n - 1]);
     }
+    if (cached)
+        cache_end(n > 0 ? job : NULL);
+    Sigprocmask(SIG_SETMASK, &prev, NULL);
     return;
 }
 
+/*
+ * split_pipeline - cut argv at each "|" into the argv of each stage.
+ * Returns the number of stages, or -1 if a stage is empty.
+ */
+int split_pipeline(char **argv, char ***cmds)
+{
+    int i, n = 0;
+
+    cmds[n++] = argv;
+    for (i = 0; argv[i] != NULL; i++) {
+        if (!IS_OP(argv[i]) || strcmp(argv[i], "|"))
+            continue;
+        argv[i] = NULL;
+        if (cmds[n - 1][0] == NULL)
+            return -1;
+        cmds[n++] = &argv[i + 1];
+    }
+    return cmds[n - 1][0] == NULL ? -1 : n;
+}
+
+/*
+ * redirect - apply the redirections in argv to io, left to right, and
+ * take them out of argv. Files are opened here, close-on-exec, so an
+ * error can name the file; the child only gets the dup2s, through the
+ * same posix_spawn file actions as pipes. Here-documents and
+ * here-strings come from a pipe or memfd, never a file on disk. Each
+ * descriptor opened is added to opened for the caller to close once
+ * the stage is started. Returns -1, with a message, on an error.
+ */
+int redirect(char **argv, int *io, int *opened, int *nopened)
+{
+    char **w = argv, *op, *word;
+    int fd, to, i, n;
+
+    for (; *argv != NULL; argv++) {
+        op = *argv;
+        if (!IS_OP(op)) {
+            *w++ = op;
+            continue;
+        }
+        if (isdigit((unsigned char)*op))
+            fd = *op++ - '0';
+        else
+            fd = *op == '<' ? STDIN_FILENO : STDOUT_FILENO;
+        if (fd > 2 || (op[1] == '&' && op[2] - '0' > 2)) {
+            printf("%s: bad file descriptor\n", *argv);
+            return -1;
+        }
+        if (op[1] == '&') { /* n>&m: whatever m is by now */
+            io[fd] = io[op[2] - '0'];
+            continue;
+        }
+        if ((word = argv[1]) == NULL || IS_OP(word)) {
+            printf("syntax error near '%s'\n", *argv);
+            return -1;
+        }
+        argv++;
+        if (!strcmp(op, "<<<")) { /* The word and a newline: borrow the null after it */
+            n = strlen(word);
+            word[n] = '\n';
+            to = body_fd(word, n + 1);
+            word[n] = '\0';
+        } else if (!strcmp(op, "<<"))
+            to = here_doc(word);
+        else if (op[0] == '<')
+            to = open(word, O_RDONLY | O_CLOEXEC);
+        else
+            to = open(word, O_WRONLY | O_CREAT | O_CLOEXEC | (op[1] == '>' ? O_APPEND : O_TRUNC), 0666);
+        if (to < 0) {
+            printf("%s: %s\n", word, strerror(errno));
+            return -1;
+        }
+        opened[(*nopened)++] = io[fd] = to;
+    }
+    *w = NULL;
+
+    /*
+     * The child dup2s io[0], io[1], io[2] in that order. If 2>&1 left
+     * io[2] naming descriptor 1 and 1 itself is redirected, 2 would get
+     * the new file: give it a copy of the old 1 instead.
+     */
+    for (i = 0; i < 3; i++) {
+        if (io[i] < 3 && io[i] != i && io[io[i]] != io[i]) {
+            if ((to = fcntl(io[i], F_DUPFD_CLOEXEC, 3)) < 0)
+                return -1;
+            opened[(*nopened)++] = io[i] = to;
+        }
+    }
+    return 0;
+}
+
+/* here_doc - read the lines up to delim from the script into a here-document */
+int here_doc(char *delim)
+{
+    char *body = NULL, *line;
+    size_t len = 0, cap = 0, n;
+    int fd;
+
+    while ((line = next_line()) != NULL && strcmp(line, delim)) {
+        n = strlen(line);
+        if (len + n + 1 > cap)
+            body = Realloc(body, cap = 2 * (len + n + 1));
+        memcpy(body + len, line, n);
+        body[len + n] = '\n';
+        len += n + 1;
+    }
+    fd = body_fd(body, len);
+    free(body);
+    return fd;
+}
+
+/*
+ * spawn - start argv in a child process and return its pid, or -1 with
+ * errno set if it could not be started. A name without a slash is
+ * looked up in PATH through the command hash table; if the remembered
+ * file cannot be run any more, the entry is dropped and PATH searched
+ * once again. pgid and fg are as for spawn_path.
+ */
+pid_t spawn(char **argv, int *io, pid_t pgid, int fg)
+{
+    char *path;
+    pid_t pid;
+    int tries;
+
+    for (tries = 0; tries < 2; tries++) {
+        if ((path = find_command(argv[0])) == NULL) {
+            errno = ENOENT;
+            return -1;
+        }
+        if ((pid = spawn_path(path, argv, io, pgid, fg)) >= 0 || strchr(argv[0], '/') != NULL)
+            return pid;
+        forget_command(argv[0]);
+    }
+    return -1;
+}
+
+/*
+ * spawn_path - start the program at path with io[0..2] as its standard
+ * input, output and error (NULL: the shell's own). Other descriptors
+ * the shell opens are close-on-exec. The child joins process group
+ * pgid, a new one if it is 0 or the shell's if it is -1, and takes
+ * the terminal if fg is set. posix_spawn runs the child on
+ * the shell's memory until it execs (vfork semantics), so no page
+ * tables are copied however big the shell grows. Build with
+ * -DSPAWN_FORK to use fork and execve instead, for comparison.
+ */
+pid_t spawn_path(char *path, char **argv, int *io, pid_t pgid, int fg)
+{
+    pid_t pid;
+    int i;
+#ifdef SPAWN_FORK
+    fflush(stdout);
+    if ((pid = Fork()) == 0) {
+        if (pgid >= 0)
+            setpgid(0, pgid);
+        if (fg && pgid >= 0 && shell_terminal >= 0)
+            tcsetpgrp(shell_terminal, getpgrp());
+        child_signals();
+        for (i = 0; io != NULL && i < 3; i++)
+            if (io[i] != i)
+                dup2(io[i], i);
+        execve(path, argv, environ);
+        printf("%s: Command not found.\n", argv[0]);
+        fflush(stdout);
+        _exit(127);
+    }
+#else
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    sigset_t defaults, none;
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    int rc;
+
+    /* The child gets default job signals and an empty mask, whatever the shell uses */
+    posix_spawnattr_init(&attr);
+    sigemptyset(&defaults);
+    for (i = 0; i < NUM_JOB_SIGNALS; i++)
+        sigaddset(&defaults, job_signals[i]);
+    sigemptyset(&none);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setsigmask(&attr, &none);
+    if (pgid >= 0) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, pgid);
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    posix_spawn_file_actions_init(&fa);
+#ifdef HAVE_TCSETPGRP_NP
+    /* Before the exec, so a command reading the terminal at once is not stopped */
+    if (fg && pgid >= 0 && shell_terminal >= 0)
+        posix_spawn_file_actions_addtcsetpgrp_np(&fa, shell_terminal);
+#endif
+    for (i = 0; io != NULL && i < 3; i++)
+        if (io[i] != i)
+            posix_spawn_file_actions_adddup2(&fa, io[i], i);
+    rc = posix_spawn(&pid, path, &fa, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    posix_spawnattr_destroy(&attr);
+    if (rc != 0) {
+        errno = rc;
+        return -1;
+    }
+#endif
+    return pid;
+}
+
+/*
+ * fork_builtin - run a builtin as a pipeline stage. It must not run in
+ * the shell itself, so this is the one place a plain fork is needed.
+ * other is the read end of the stage's own output pipe, or -1; pgid
+ * and fg are as for spawn_path.
+ */
+pid_t fork_builtin(char **argv, int *io, int other, pid_t pgid, int fg)
+{
+    pid_t pid;
+    int i;
+
+    fflush(stdout); /* Or the child writes the shell's buffered output again */
+    if ((pid = Fork()) == 0) {
+        if (pgid >= 0)
+            setpgid(0, pgid);
+        if (fg && pgid >= 0 && shell_terminal >= 0)
+            tcsetpgrp(shell_terminal, getpgrp());
+        child_signals();
+        /* The shell's jobs are not this child's; its own, e.g. parallel's, need the handler */
+        memset(jobs, 0, sizeof(jobs));
+        shell_terminal = -1;
+        Signal(SIGCHLD, sigchld_handler);
+        if (other >= 0)
+            close(other);
+        for (i = 0; i < 3; i++)
+            if (io[i] != i)
+                dup2(io[i], i);
+        last_status = 0;
+        builtin_command(argv);
+        fflush(stdout);
+        _exit(last_status);
+    }
+    return pid;
+}
+
+/*
+ * run_builtin - run a builtin in the shell itself. Its redirections
+ * hold while it runs: the shell's own descriptors are set aside and
+ * put back after.
+ */
+void run_builtin(char **argv)
+{
+    int io[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    int opened[MAXARGS], saved[3], n = 0, i;
+
+    if (redirect(argv, io, opened, &n) < 0) {
+        last_status = 1;
+    } else {
+        fflush(stdout);
+        for (i = 0; i < 3; i++) {
+            saved[i] = -1;
+            if (io[i] != i) {
+                saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 3);
+                dup2(io[i], i);
+            }
+        }
+        builtin_command(argv);
+        fflush(stdout);
+        for (i = 0; i < 3; i++) {
+            if (saved[i] >= 0) {
+                dup2(saved[i], i);
+                close(saved[i]);
+            }
+        }
+    }
+    while (n > 0)
+        close(opened[--n]);
+}
+
 /* If first arg is a builtin command, run it and return true */
 int builtin_command(char **argv) 
 {
@@ -61,42 +730,1346 @@ int builtin_command(char **argv)
 	exit(0);  
     if (!strcmp(argv[0], "&"))    /* Ignore singleton & */
 	return 1;
+    if (!strcmp(argv[0], "jobs")) {
+	report_jobs(1);
+	return 1;
+    }
+    if (!strcmp(argv[0], "fg") || !strcmp(argv[0], "bg")) { /* fg/bg [%jid | pid] */
+	do_fgbg(argv);
+	return 1;
+    }
+    if (!strcmp(argv[0], "kill")) { /* kill [-sig] %jid | pid ... */
+	do_kill(argv);
+	return 1;
+    }
+    if (!strcmp(argv[0], "parallel")) { /* parallel [-j N] cmd ... ::: arg ... */
+	do_parallel(argv);
+	return 1;
+    }
+    if (!strcmp(argv[0], "relay")) { /* relay [file]: pass data through, zero-copy */
+	relay(argv[1]);
+	return 1;
+    }
+    if (!strcmp(argv[0], "export")) { /* export NAME=value ...: set for $NAME and commands */
+	for (argv++; *argv != NULL; argv++) {
+	    char *eq = strchr(*argv, '=');
+
+	    if (eq == NULL || eq == *argv) {
+		printf("export: %s: not NAME=value\n", *argv);
+		continue;
+	    }
+	    *eq = '\0';
+	    setenv(*argv, eq + 1, 1);
+	}
+	return 1;
+    }
+    if (!strcmp(argv[0], "unset")) { /* unset NAME ... */
+	for (argv++; *argv != NULL; argv++)
+	    unsetenv(*argv);
+	return 1;
+    }
+    if (!strcmp(argv[0], "time")) { /* time [on | off]: summary so far, or time every job */
+	do_time(argv);
+	return 1;
+    }
+    if (!strcmp(argv[0], "hash")) { /* hash: list, hash -r: forget all */
+	if (argv[1] != NULL && !strcmp(argv[1], "-r"))
+	    clear_commands();
+	else
+	    print_commands();
+	return 1;
+    }
     return 0;                     /* Not a builtin command */
 }
+
+/* is_builtin - true if name is run by builtin_command, not spawned */
+int is_builtin(char *name)
+{
+    return !strcmp(name, "quit") || !strcmp(name, "&") || !strcmp(name, "relay")
+        || !strcmp(name, "hash") || !strcmp(name, "jobs") || !strcmp(name, "fg")
+        || !strcmp(name, "bg") || !strcmp(name, "kill") || !strcmp(name, "parallel")
+        || !strcmp(name, "time") || !strcmp(name, "export") || !strcmp(name, "unset");
+}
 /* $end eval */
 
+/* $begin jobs */
+/*
+ * init_shell - install the SIGCHLD handler, and if the shell is
+ * interactive, take over the terminal: put the shell in its own process
+ * group in the foreground and ignore the signals the terminal sends to
+ * that group.
+ */
+void init_shell(void)
+{
+    int i;
+
+    Signal(SIGCHLD, sigchld_handler);
+    if (!interactive)
+        return;
+
+    /* Started in the background: wait to be brought to the foreground */
+    while (tcgetpgrp(STDIN_FILENO) != (shell_pgid = getpgrp()))
+        kill(-shell_pgid, SIGTTIN);
+    for (i = 0; i < NUM_JOB_SIGNALS; i++)
+        if (job_signals[i] != SIGCHLD)
+            Signal(job_signals[i], SIG_IGN);
+    setpgid(0, 0); /* Fails harmlessly if the shell leads its session */
+    shell_pgid = getpgrp();
+    tcsetpgrp(STDIN_FILENO, shell_pgid);
+    shell_terminal = STDIN_FILENO;
+}
+
+/* child_signals - undo the shell's signal setup in a forked child */
+void child_signals(void)
+{
+    sigset_t none;
+    int i;
+
+    for (i = 0; i < NUM_JOB_SIGNALS; i++)
+        Signal(job_signals[i], SIG_DFL);
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+}
+
+/*
+ * sigchld_handler - reap every child that ended, and note those that
+ * stopped or continued, without blocking. Only job fields are written,
+ * so it is async-signal-safe; messages wait for the next prompt.
+ * wait4 hands over each child's resource usage as it is reaped.
+ */
+void sigchld_handler(int sig)
+{
+    int olderrno = errno;
+    int status, i, j;
+    struct rusage ru;
+    pid_t pid;
+
+    while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &ru)) > 0) {
+        for (i = 0; i < MAXJOBS; i++) {
+            if (jobs[i].state == UNDEF)
+                continue;
+            for (j = 0; j < jobs[i].nprocs; j++)
+                if (jobs[i].pids[j] == pid && jobs[i].pstate[j] != P_DONE)
+                    break; /* A reaped pid may have been reused */
+            if (j == jobs[i].nprocs)
+                continue;
+            if (WIFSTOPPED(status))
+                jobs[i].pstate[j] = P_STOP;
+            else if (WIFCONTINUED(status))
+                jobs[i].pstate[j] = P_RUN;
+            else {
+                jobs[i].status[j] = status;
+                jobs[i].pstate[j] = P_DONE;
+                add_usage(&jobs[i].usage, &ru);
+            }
+            update_job(&jobs[i]);
+            break;
+        }
+    }
+    errno = olderrno;
+}
+
+/* update_job - job state from the states of its processes */
+void update_job(job_t *job)
+{
+    int j, running = 0, stopped = 0;
+
+    for (j = 0; j < job->nprocs; j++) {
+        running += job->pstate[j] == P_RUN;
+        stopped += job->pstate[j] == P_STOP;
+    }
+    if (running == 0 && stopped == 0) {
+        job->state = job->state == FG ? UNDEF : DONE; /* wait_fg needs no report */
+        job->end = now_sec(); /* clock_gettime is async-signal-safe */
+    }
+    else if (running == 0)
+        job->state = ST;
+    else if (job->state == ST) /* Continued from outside */
+        job->state = BG;
+}
+
+/* free_jobs - number of free slots in the job table */
+int free_jobs(void)
+{
+    int i, n = 0;
+
+    for (i = 0; i < MAXJOBS; i++)
+        n += jobs[i].state == UNDEF;
+    return n;
+}
+
+/* add_job - enter a job; caller blocks SIGCHLD and has checked free_jobs */
+job_t *add_job(pid_t *pids, int n, int state, char *cmdline)
+{
+    job_t *job = NULL;
+    int i, jid = 0;
+
+    for (i = 0; i < MAXJOBS; i++) {
+        if (jobs[i].state == UNDEF && job == NULL)
+            job = &jobs[i];
+        else if (jobs[i].state != UNDEF && jobs[i].jid > jid)
+            jid = jobs[i].jid;
+    }
+    job->jid = jid + 1;
+    job->pgid = shell_terminal >= 0 && n > 0 ? pids[0] : 0; /* parallel adds its runs later */
+    job->timed = 0;
+    job->start = now_sec();
+    memset(&job->usage, 0, sizeof(job->usage));
+    job->nprocs = n;
+    for (i = 0; i < n; i++) {
+        job->pids[i] = pids[i];
+        job->pstate[i] = P_RUN;
+    }
+    strcpy(job->cmdline, cmdline);
+    i = strcspn(job->cmdline, "\n");
+    while (i > 0 && (job->cmdline[i - 1] == ' ' || job->cmdline[i - 1] == '&'))
+        i--; /* Drop the "&"; listings add it back while the job runs in the background */
+    job->cmdline[i] = '\0';
+    job->state = state;
+    return job;
+}
+
+/*
+ * find_job - the job spec names: %jid, or the pid of one of its
+ * processes. No spec means the most recent job. Caller blocks SIGCHLD.
+ */
+job_t *find_job(char *spec)
+{
+    job_t *job = NULL;
+    int i, j, id;
+
+    if (spec != NULL && (id = atoi(spec[0] == '%' ? spec + 1 : spec)) <= 0)
+        return NULL;
+    for (i = 0; i < MAXJOBS; i++) {
+        if (jobs[i].state == UNDEF || jobs[i].state == DONE)
+            continue;
+        if (spec == NULL) {
+            if (job == NULL || jobs[i].jid > job->jid)
+                job = &jobs[i];
+        } else if (spec[0] == '%') {
+            if (jobs[i].jid == id)
+                return &jobs[i];
+        } else {
+            for (j = 0; j < jobs[i].nprocs; j++)
+                if (jobs[i].pids[j] == id)
+                    return &jobs[i];
+        }
+    }
+    return job;
+}
+
+/*
+ * wait_fg - give the job the terminal and sleep until it is no longer
+ * in the foreground; the SIGCHLD handler does the waiting. mask is the
+ * signal mask to sleep with, which lets SIGCHLD in.
+ */
+void wait_fg(job_t *job, sigset_t *mask)
+{
+    if (shell_terminal >= 0)
+        tcsetpgrp(shell_terminal, job->pgid);
+    while (job->state == FG)
+        sigsuspend(mask);
+    if (shell_terminal >= 0)
+        tcsetpgrp(shell_terminal, shell_pgid);
+    if (job->state == UNDEF) { /* Ended; the slot still holds the statuses */
+        int st = job->status[job->nprocs - 1];
+
+        last_status = WIFEXITED(st) ? WEXITSTATUS(st) : 128 + WTERMSIG(st);
+        if (job->timed)
+            time_job(job->cmdline, job->end - job->start, &job->usage);
+    }
+    if (job->state == ST)
+        printf("\n[%d]+  Stopped\t\t%s\n", job->jid, job->cmdline);
+}
+
+/*
+ * report_jobs - print the jobs that ended in the background and free
+ * their slots; with all set, list the others too (the jobs builtin).
+ * Scripts free the ended jobs without a word.
+ */
+void report_jobs(int all)
+{
+    static char *names[] = { "", "Running", "Running", "Stopped", "Done" };
+    sigset_t mask, prev;
+    int i;
+
+    /* Called for every line of a script; most of the time there is nothing to do */
+    for (i = 0; i < MAXJOBS && !all && jobs[i].state != DONE; i++)
+        ;
+    if (i == MAXJOBS)
+        return;
+
+    Sigemptyset(&mask);
+    Sigaddset(&mask, SIGCHLD);
+    Sigprocmask(SIG_BLOCK, &mask, &prev);
+    for (i = 0; i < MAXJOBS; i++) {
+        if (jobs[i].state == UNDEF || (!all && jobs[i].state != DONE))
+            continue;
+        if (all || interactive)
+            printf("[%d]  %-8s\t%s%s\n", jobs[i].jid, names[jobs[i].state], jobs[i].cmdline,
+                   jobs[i].state == BG ? " &" : "");
+        if (jobs[i].state == DONE) {
+            if (jobs[i].timed)
+                time_job(jobs[i].cmdline, jobs[i].end - jobs[i].start, &jobs[i].usage);
+            cache_end(&jobs[i]); /* A cached command stopped, then resumed with bg */
+            jobs[i].state = UNDEF;
+        }
+    }
+    Sigprocmask(SIG_SETMASK, &prev, NULL);
+}
+
+/* signal_job - send sig to every process of the job */
+void signal_job(job_t *job, int sig)
+{
+    int j;
+
+    if (job->pgid > 0) {
+        kill(-job->pgid, sig);
+        return;
+    }
+    for (j = 0; j < job->nprocs; j++) /* No process group without job control */
+        if (job->pstate[j] != P_DONE)
+            kill(job->pids[j], sig);
+}
+
+/* do_fgbg - continue a job in the foreground or the background */
+void do_fgbg(char **argv)
+{
+    sigset_t mask, prev;
+    job_t *job;
+    int fg = !strcmp(argv[0], "fg");
+
+    Sigemptyset(&mask);
+    Sigaddset(&mask, SIGCHLD);
+    Sigprocmask(SIG_BLOCK, &mask, &prev);
+    if ((job = find_job(argv[1])) == NULL) {
+        printf("%s: %s: no such job\n", argv[0], argv[1] ? argv[1] : "current");
+    } else if (fg) {
+        job->state = FG;
+        printf("%s\n", job->cmdline);
+        if (shell_terminal >= 0)
+            tcsetpgrp(shell_terminal, job->pgid);
+        signal_job(job, SIGCONT);
+        wait_fg(job, &prev);
+        cache_end(job); /* If it was a stopped cached command */
+    } else {
+        if (job->state == ST)
+            job->state = BG;
+        signal_job(job, SIGCONT);
+        printf("[%d] %s &\n", job->jid, job->cmdline);
+    }
+    Sigprocmask(SIG_SETMASK, &prev, NULL);
+}
+
+/* do_kill - kill [-sig] %jid | pid ...; sig is a number or a name like TERM */
+void do_kill(char **argv)
+{
+    static struct { char *name; int sig; } names[] = {
+        { "HUP", SIGHUP }, { "INT", SIGINT }, { "QUIT", SIGQUIT }, { "KILL", SIGKILL },
+        { "USR1", SIGUSR1 }, { "USR2", SIGUSR2 }, { "TERM", SIGTERM },
+        { "CONT", SIGCONT }, { "STOP", SIGSTOP }, { "TSTP", SIGTSTP },
+    };
+    sigset_t mask, prev;
+    job_t *job;
+    int i, sig = SIGTERM;
+
+    argv++;
+    if (*argv != NULL && (*argv)[0] == '-') {
+        char *name = *argv + 1;
+
+        if (!strncmp(name, "SIG", 3))
+            name += 3;
+        sig = atoi(name);
+        for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+            if (!strcmp(name, names[i].name))
+                sig = names[i].sig;
+        if (sig <= 0) {
+            printf("kill: %s: invalid signal\n", *argv);
+            return;
+        }
+        argv++;
+    }
+    if (*argv == NULL) {
+        printf("usage: kill [-sig] %%jid | pid ...\n");
+        return;
+    }
+
+    Sigemptyset(&mask);
+    Sigaddset(&mask, SIGCHLD);
+    Sigprocmask(SIG_BLOCK, &mask, &prev);
+    for (; *argv != NULL; argv++) {
+        if ((*argv)[0] == '%') {
+            if ((job = find_job(*argv)) == NULL) {
+                printf("kill: %s: no such job\n", *argv);
+                continue;
+            }
+            signal_job(job, sig);
+            if (job->state == ST && sig != SIGSTOP && sig != SIGTSTP)
+                signal_job(job, SIGCONT); /* So it can act on sig */
+        } else if (kill(atoi(*argv), sig) < 0) {
+            printf("kill: %s: %s\n", *argv, strerror(errno));
+        }
+    }
+    Sigprocmask(SIG_SETMASK, &prev, NULL);
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * do_parallel - parallel [-j N] cmd ... ::: arg ...
+ * Run cmd once per arg, with every {} in cmd replaced by the arg, or
+ * the arg appended if there is no {}. At most N run at once (default: one per
+ * CPU); when one ends, the SIGCHLD handler wakes us and the next
+ * starts. The runs form a single foreground job, with one process
+ * slot per runner, and each is reported with its wall time. A run
+ * killed by SIGINT (Ctrl-C) stops further starts. The status is the
+ * number of failed runs, at most 101, as GNU parallel's is.
+ */
+void do_parallel(char **argv)
+{
+    char *cmd[MAXARGS], words[MAXLINE], cmdline[MAXLINE];
+    char **tmpl, **args, *w;
+    int ntmpl, nargs, njobs, next, running, interrupted = 0, failed = 0;
+    int slot_arg[MAXPROCS], subst, i, j, st;
+    double start[MAXPROCS], t0, busy = 0, secs;
+    sigset_t mask, prev;
+    pid_t pid;
+    job_t *job;
+
+    njobs = sysconf(_SC_NPROCESSORS_ONLN);
+    argv++;
+    if (*argv != NULL && !strcmp(*argv, "-j")) {
+        if (argv[1] == NULL || (njobs = atoi(argv[1])) <= 0) {
+            printf("parallel: -j needs a positive number\n");
+            return;
+        }
+        argv += 2;
+    }
+    njobs = njobs > MAXPROCS ? MAXPROCS : njobs;
+    tmpl = argv;
+    for (ntmpl = 0; tmpl[ntmpl] != NULL && strcmp(tmpl[ntmpl], ":::"); ntmpl++)
+        ;
+    if (ntmpl >= MAXARGS - 1) {
+        printf("parallel: command too long\n");
+        return;
+    }
+    if (ntmpl == 0 || tmpl[ntmpl] == NULL) {
+        printf("usage: parallel [-j N] cmd ... ::: arg ...\n");
+        return;
+    }
+    args = &tmpl[ntmpl + 1];
+    for (nargs = 0; args[nargs] != NULL; nargs++)
+        ;
+    for (i = 0, w = cmdline; argv[i] != NULL && w < cmdline + MAXLINE - 1; i++)
+        w += snprintf(w, cmdline + MAXLINE - w, "%s%s", i ? " " : "parallel ", argv[i]);
+
+    Sigemptyset(&mask);
+    Sigaddset(&mask, SIGCHLD);
+    Sigprocmask(SIG_BLOCK, &mask, &prev);
+    if (!free_jobs()) {
+        printf("Too many jobs\n");
+        Sigprocmask(SIG_SETMASK, &prev, NULL);
+        return;
+    }
+    job = add_job(NULL, 0, FG, cmdline);
+    job->pgid = 0; /* Runs stay in the shell's group, which has the terminal */
+
+    t0 = now_sec();
+    next = running = 0;
+    while (running > 0 || (next < nargs && !interrupted)) {
+        /* Fill the free slots */
+        for (i = 0; i < njobs && next < nargs && !interrupted; i++) {
+            if (i < job->nprocs && job->pstate[i] != P_DONE)
+                continue;
+            for (j = subst = 0, w = words; j < ntmpl && w != NULL; j++) {
+                if (strstr(tmpl[j], "{}") == NULL) {
+                    cmd[j] = tmpl[j];
+                    continue;
+                }
+                cmd[j] = w;
+                w = fill_holes(w, words + MAXLINE - w, tmpl[j], args[next]);
+                subst = 1;
+            }
+            if (!subst)
+                cmd[j++] = args[next];
+            cmd[j] = NULL;
+            if (w == NULL) {
+                printf("parallel: %s: command too long\n", args[next++]);
+                failed++;
+                i--;
+                continue;
+            }
+            if ((pid = spawn(cmd, NULL, -1, 0)) < 0) {
+                printf("%s: Command not found.\n", cmd[0]);
+                next++;
+                failed++;
+                i--; /* The slot is still free */
+                continue;
+            }
+            job->pids[i] = pid;
+            job->pstate[i] = P_RUN;
+            if (i == job->nprocs)
+                job->nprocs++;
+            job->state = FG; /* The handler frees the job whenever nothing runs */
+            slot_arg[i] = next++;
+            start[i] = now_sec();
+            running++;
+        }
+        if (running == 0)
+            break;
+        sigsuspend(&prev);
+
+        /* Report the runs that ended */
+        for (i = 0; i < job->nprocs; i++) {
+            if (slot_arg[i] < 0 || job->pstate[i] != P_DONE)
+                continue;
+            st = job->status[i];
+            secs = now_sec() - start[i];
+            busy += secs;
+            if (WIFEXITED(st))
+                printf("[%s] %.3f s, exit %d\n", args[slot_arg[i]], secs, WEXITSTATUS(st));
+            else
+                printf("[%s] %.3f s, signal %d\n", args[slot_arg[i]], secs, WTERMSIG(st));
+            failed += !WIFEXITED(st) || WEXITSTATUS(st) != 0;
+            interrupted |= WIFSIGNALED(st) && WTERMSIG(st) == SIGINT;
+            slot_arg[i] = -1;
+            running--;
+        }
+        if (job->state == ST) /* Not a job that can be stopped */
+            signal_job(job, SIGCONT);
+    }
+    job->state = UNDEF;
+    printf("parallel: %d of %d run, %d failed, %.3f s wall, %.3f s total\n",
+           next, nargs, failed, now_sec() - t0, busy);
+    last_status = failed > 101 ? 101 : failed;
+    Sigprocmask(SIG_SETMASK, &prev, NULL);
+}
+
+/*
+ * fill_holes - copy tmpl to dst, size bytes at most, with every {} in
+ * it replaced by arg. Returns the byte after the copy's '\0', or NULL
+ * if it does not fit.
+ */
+char *fill_holes(char *dst, size_t size, char *tmpl, char *arg)
+{
+    size_t n, alen = strlen(arg);
+    char *hole;
+
+    while (1) {
+        hole = strstr(tmpl, "{}");
+        n = hole != NULL ? (size_t)(hole - tmpl) : strlen(tmpl);
+        if (n + (hole != NULL ? alen : 0) >= size)
+            return NULL;
+        memcpy(dst, tmpl, n);
+        dst += n;
+        size -= n;
+        if (hole == NULL) {
+            *dst = '\0';
+            return dst + 1;
+        }
+        memcpy(dst, arg, alen);
+        dst += alen;
+        size -= alen;
+        tmpl = hole + 2;
+    }
+}
+/* $end jobs */
+
+/* $begin time */
+/* Jobs timed so far, for the summary */
+static long time_count;
+static long time_hist[TIME_BUCKETS];
+static double time_wall, time_user, time_sys;
+static struct {
+    double wall;
+    char cmdline[64];
+} time_slowest[TIME_SLOWEST];
+
+static double tv_sec(struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/* add_usage - add ru to sum; called from the SIGCHLD handler */
+void add_usage(struct rusage *sum, struct rusage *ru)
+{
+    sum->ru_utime.tv_sec += ru->ru_utime.tv_sec;
+    sum->ru_utime.tv_usec += ru->ru_utime.tv_usec;
+    sum->ru_stime.tv_sec += ru->ru_stime.tv_sec;
+    sum->ru_stime.tv_usec += ru->ru_stime.tv_usec;
+    if (ru->ru_maxrss > sum->ru_maxrss)
+        sum->ru_maxrss = ru->ru_maxrss;
+    sum->ru_nvcsw += ru->ru_nvcsw;
+    sum->ru_nivcsw += ru->ru_nivcsw;
+}
+
+/*
+ * time_job - report the wall time and resource usage of a job that
+ * ended, on stderr like time(1), and count it in the summary. maxrss
+ * is that of the biggest process; csw are voluntary+involuntary
+ * context switches.
+ */
+void time_job(char *cmdline, double wall, struct rusage *ru)
+{
+    double user = tv_sec(&ru->ru_utime), sys = tv_sec(&ru->ru_stime);
+    int b, i;
+
+    fflush(stdout);
+    fprintf(stderr, "%9.3fs real %9.3fs user %9.3fs sys %8ldK rss %6ld+%ld csw  %s\n",
+            wall, user, sys, ru->ru_maxrss, ru->ru_nvcsw, ru->ru_nivcsw, cmdline);
+
+    time_count++;
+    time_wall += wall;
+    time_user += user;
+    time_sys += sys;
+    for (b = 0; b < TIME_BUCKETS - 1 && wall >= (1L << b) / 1e3; b++)
+        ;
+    time_hist[b]++;
+    /* Insertion into the slowest few, kept sorted */
+    for (i = TIME_SLOWEST; i > 0 && wall > time_slowest[i - 1].wall; i--)
+        if (i < TIME_SLOWEST)
+            time_slowest[i] = time_slowest[i - 1];
+    if (i < TIME_SLOWEST) {
+        time_slowest[i].wall = wall;
+        snprintf(time_slowest[i].cmdline, sizeof(time_slowest[i].cmdline), "%s", cmdline);
+    }
+}
+
+/*
+ * time_builtin - run a builtin in the shell and time it. Its usage is
+ * the shell's own over the run plus that of the children reaped in
+ * the meantime, e.g. the runs of parallel.
+ */
+void time_builtin(char **argv, char *cmdline)
+{
+    struct rusage self0, kids0, self1, kids1, ru;
+    char text[MAXLINE], *w;
+    double t0 = now_sec();
+    int i;
+
+    getrusage(RUSAGE_SELF, &self0);
+    getrusage(RUSAGE_CHILDREN, &kids0);
+    for (i = 0, w = text, *w = '\0'; argv[i] != NULL && w < text + MAXLINE; i++)
+        w += snprintf(w, text + MAXLINE - w, "%s%s", i ? " " : "", argv[i]);
+    run_builtin(argv);
+    getrusage(RUSAGE_SELF, &self1);
+    getrusage(RUSAGE_CHILDREN, &kids1);
+
+    memset(&ru, 0, sizeof(ru));
+    timersub(&self1.ru_utime, &self0.ru_utime, &ru.ru_utime);
+    timersub(&self1.ru_stime, &self0.ru_stime, &ru.ru_stime);
+    timeradd(&ru.ru_utime, &kids1.ru_utime, &ru.ru_utime);
+    timeradd(&ru.ru_stime, &kids1.ru_stime, &ru.ru_stime);
+    timersub(&ru.ru_utime, &kids0.ru_utime, &ru.ru_utime);
+    timersub(&ru.ru_stime, &kids0.ru_stime, &ru.ru_stime);
+    ru.ru_maxrss = self1.ru_maxrss > kids1.ru_maxrss ? self1.ru_maxrss : kids1.ru_maxrss;
+    ru.ru_nvcsw = self1.ru_nvcsw - self0.ru_nvcsw + kids1.ru_nvcsw - kids0.ru_nvcsw;
+    ru.ru_nivcsw = self1.ru_nivcsw - self0.ru_nivcsw + kids1.ru_nivcsw - kids0.ru_nivcsw;
+    time_job(cmdline != NULL ? cmdline : text, now_sec() - t0, &ru);
+}
+
+/*
+ * time_summary - totals of the jobs timed so far, a histogram of their
+ * wall times in powers of two from 1 ms, and the slowest of them
+ */
+void time_summary(void)
+{
+    long most = 1;
+    int b, lo, hi, i;
+
+    if (time_count == 0)
+        return;
+    fflush(stdout);
+    fprintf(stderr, "time: %ld jobs, %.3fs real, %.3fs user, %.3fs sys\n",
+            time_count, time_wall, time_user, time_sys);
+    for (lo = 0; time_hist[lo] == 0; lo++)
+        ;
+    for (hi = TIME_BUCKETS - 1; time_hist[hi] == 0; hi--)
+        ;
+    for (b = lo; b <= hi; b++)
+        most = time_hist[b] > most ? time_hist[b] : most;
+    for (b = lo; b <= hi; b++) {
+        if (b < TIME_BUCKETS - 1)
+            fprintf(stderr, "  < %9.3fs %7ld", (1L << b) / 1e3, time_hist[b]);
+        else
+            fprintf(stderr, " >= %9.3fs %7ld", (1L << (b - 1)) / 1e3, time_hist[b]);
+        for (i = 0; i < (time_hist[b] * 40 + most - 1) / most; i++)
+            fputs(i ? "#" : " #", stderr);
+        fputc('\n', stderr);
+    }
+    fprintf(stderr, "slowest:\n");
+    for (i = 0; i < TIME_SLOWEST && time_slowest[i].wall > 0; i++)
+        fprintf(stderr, "  %9.3fs  %s\n", time_slowest[i].wall, time_slowest[i].cmdline);
+}
+
+/* do_time - time: the summary so far; time on | off: time every job or not */
+void do_time(char **argv)
+{
+    static int registered;
+
+    if (argv[1] == NULL) {
+        time_summary();
+    } else if (!strcmp(argv[1], "on")) {
+        timing = 1;
+        if (!registered++)
+            atexit(time_summary); /* Scripts and quit end in exit */
+    } else if (!strcmp(argv[1], "off")) {
+        timing = 0;
+    }
+}
+/* $end time */
+
+/* $begin hash */
+static unsigned int hash_name(char *name)
+{
+    unsigned int h = 5381;
+
+    while (*name)
+        h = h * 33 + (unsigned char)*name++;
+    return h % HASH_SIZE;
+}
+
+/*
+ * find_command - full path of the program name runs, or NULL if no
+ * directory in PATH has it. Results are remembered, like bash's hash
+ * table, so a script does not stat every PATH directory for every
+ * command; a change of PATH empties the table. Names with a slash are
+ * used as they are.
+ */
+char *find_command(char *name)
+{
+    char *pathenv = getenv("PATH"), *dir, *end;
+    char file[MAXLINE];
+    cmd_entry_t *e;
+    unsigned int h;
+    size_t len;
+    struct stat st;
+
+    if (strchr(name, '/') != NULL)
+        return name;
+    if (pathenv == NULL)
+        pathenv = "/bin:/usr/bin";
+    if (cmd_table_path == NULL || strcmp(cmd_table_path, pathenv)) {
+        clear_commands();
+        cmd_table_path = strdup(pathenv);
+    }
+
+    h = hash_name(name);
+    for (e = cmd_table[h]; e != NULL; e = e->next) {
+        if (!strcmp(e->name, name)) {
+            e->hits++;
+            return e->path;
+        }
+    }
+
+    /* Search PATH; an empty entry means the current directory */
+    for (dir = pathenv; ; dir = end + 1) {
+        end = strchr(dir, ':');
+        len = end ? (size_t)(end - dir) : strlen(dir);
+        if (len == 0)
+            snprintf(file, sizeof(file), "./%s", name);
+        else
+            snprintf(file, sizeof(file), "%.*s/%s", (int)len, dir, name);
+        /* access() passes directories too, which would only fail later with EACCES */
+        if (access(file, X_OK) == 0 && stat(file, &st) == 0 && S_ISREG(st.st_mode)) {
+            e = Malloc(sizeof(cmd_entry_t));
+            e->name = strdup(name);
+            e->path = strdup(file);
+            e->hits = 1;
+            e->next = cmd_table[h];
+            cmd_table[h] = e;
+            return e->path;
+        }
+        if (end == NULL)
+            return NULL;
+    }
+}
+
+/* forget_command - drop name from the table, e.g. after its file went away */
+void forget_command(char *name)
+{
+    cmd_entry_t **pp, *e;
+
+    for (pp = &cmd_table[hash_name(name)]; (e = *pp) != NULL; pp = &e->next) {
+        if (!strcmp(e->name, name)) {
+            *pp = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+            return;
+        }
+    }
+}
+
+void clear_commands(void)
+{
+    cmd_entry_t *e;
+    int i;
+
+    for (i = 0; i < HASH_SIZE; i++) {
+        while ((e = cmd_table[i]) != NULL) {
+            cmd_table[i] = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+        }
+    }
+    free(cmd_table_path);
+    cmd_table_path = NULL;
+}
+
+void print_commands(void)
+{
+    cmd_entry_t *e;
+    int i, any = 0;
+
+    for (i = 0; i < HASH_SIZE; i++) {
+        for (e = cmd_table[i]; e != NULL; e = e->next) {
+            if (!any++)
+                printf("hits\tcommand\n");
+            printf("%4d\t%s\n", e->hits, e->path);
+        }
+    }
+    if (!any)
+        printf("hash: hash table empty\n");
+}
+/* $end hash */
+
 /* $begin parseline */
-/* parseline - Parse the command line and build the argv array */
-int parseline(char *buf, char **argv) 
+/*
+ * The words of a command are built in an arena: a block kept from one
+ * command to the next, with more chained on for big commands. Nothing
+ * is freed word by word; parseline drops the last command's words in
+ * one go. argv itself is a vector that grows as needed and is reused.
+ * Operators ("|", redirections) are copied to ops instead, so a quoted
+ * "|" or ">" is an ordinary word: IS_OP tells them apart.
+ */
+static arena_block_t *arena;
+static size_t word_len;       /* Of the word being built at the arena's end */
+static int word_glob;         /* It has unquoted glob characters */
+static char **words;          /* argv */
+static size_t nwords, words_size;
+
+/* arena_reset - free the words of the last command */
+static void arena_reset(void)
+{
+    arena_block_t *b;
+
+    while (arena != NULL && arena->next != NULL) {
+        b = arena;
+        arena = arena->next;
+        free(b);
+    }
+    if (arena == NULL) {
+        arena = Malloc(sizeof(arena_block_t) + ARENA_BLOCK);
+        arena->next = NULL;
+        arena->size = ARENA_BLOCK;
+    }
+    arena->used = 0;
+    word_len = 0;
+}
+
+/* word_room - make room for n more bytes of the current word, and a null */
+static char *word_room(size_t n)
+{
+    arena_block_t *b;
+    size_t size;
+
+    if (arena->used + word_len + n + 1 > arena->size) {
+        size = 2 * (word_len + n + 1) > ARENA_BLOCK ? 2 * (word_len + n + 1) : ARENA_BLOCK;
+        b = Malloc(sizeof(arena_block_t) + size);
+        b->next = arena;
+        b->size = size;
+        b->used = 0;
+        memcpy(b->data, arena->data + arena->used, word_len);
+        arena = b;
+    }
+    return arena->data + arena->used + word_len;
+}
+
+static void word_add(char *s, size_t n)
+{
+    memcpy(word_room(n), s, n);
+    word_len += n;
+}
+
+/* word_lit - add c so that it matches only itself: glob characters are escaped */
+static void word_lit(char c)
+{
+    char esc[2] = { '\\', c };
+
+    if (strchr("*?[\\", c) != NULL)
+        word_add(esc, 2);
+    else
+        word_add(&c, 1);
+}
+
+/* word_end - null-terminate the current word and keep it */
+static char *word_end(void)
+{
+    char *w = word_room(0);
+
+    *w = '\0';
+    w -= word_len;
+    arena->used += word_len + 1;
+    word_len = 0;
+    return w;
+}
+
+static void push_word(char *w)
+{
+    if (nwords + 1 >= words_size) {
+        words_size = words_size ? 2 * words_size : MAXARGS;
+        words = Realloc(words, words_size * sizeof(char *));
+    }
+    words[nwords++] = w;
+}
+
+/* unescape - drop the backslashes word_lit added, in place */
+static void unescape(char *w)
+{
+    char *d = w;
+
+    for (; *w; w++)
+        *d++ = *w == '\\' && w[1] ? *++w : *w;
+    *d = '\0';
+}
+
+/*
+ * redir_len - length of the redirection operator s starts with, or 0:
+ * <, >, >> or >&m after an optional descriptor digit, << or <<<.
+ */
+int redir_len(char *s)
+{
+    char *p = s;
+
+    if (isdigit((unsigned char)*p) && (p[1] == '<' || p[1] == '>'))
+        p++;
+    if (*p == '<') {
+        p++;
+        if (*p == '<')
+            p += p[1] == '<' ? 2 : 1;
+    } else if (*p == '>') {
+        p++;
+        if (*p == '>')
+            p++;
+        else if (*p == '&' && isdigit((unsigned char)p[1]))
+            p += 2;
+    } else
+        return 0;
+    return p - s;
+}
+
+/*
+ * expand_var - add the value of the $ expansion at p to the current
+ * word and return what follows it: $NAME, ${NAME}, $? or $$. Unset
+ * names are empty. Values are not split into words; unquoted, their
+ * glob characters still match.
+ */
+char *expand_var(char *p, int quoted)
+{
+    char name[256], num[16], *val, *end;
+    size_t n;
+
+    p++;
+    if (*p == '?' || *p == '$') {
+        snprintf(num, sizeof(num), "%d", *p == '?' ? last_status : (int)getpid());
+        word_add(num, strlen(num));
+        return p + 1;
+    }
+    if (*p == '{' && (end = strchr(p, '}')) != NULL) {
+        n = end - p - 1;
+        p++;
+    } else {
+        for (n = 0; isalnum((unsigned char)p[n]) || p[n] == '_'; n++)
+            ;
+        end = p + n - 1;
+        if (n == 0 || isdigit((unsigned char)*p)) { /* Not a name: a plain $ */
+            word_add("$", 1);
+            return p;
+        }
+    }
+    snprintf(name, sizeof(name), "%.*s", (int)n, p);
+    for (val = getenv(name); val != NULL && *val; val++) {
+        if (quoted || !strchr("*?[", *val))
+            word_lit(*val);
+        else {
+            word_add(val, 1);
+            word_glob = 1;
+        }
+    }
+    return end + 1;
+}
+
+static int name_cmp(const void *a, const void *b)
+{
+    return strcmp(*(char **)a, *(char **)b);
+}
+
+/*
+ * expand_glob - add the names that match pat to argv, sorted in byte
+ * order, or pat itself if none does. When only the last component has
+ * glob characters, which is nearly always, one readdir pass does it:
+ * a name must start with the pattern's fixed prefix and, when it has
+ * no [...], end with its fixed suffix before fnmatch is asked, and for
+ * prefix*suffix that is all there is to check. Anything else is left
+ * to glob(3).
+ */
+void expand_glob(char *pat)
+{
+    char *last = strrchr(pat, '/'), *dir, *name, *w;
+    size_t first = nwords, dlen, len, pre, suf, n, i;
+    int simple;
+    struct dirent *de;
+    glob_t g;
+    DIR *dp;
+
+    last = last != NULL ? last + 1 : pat;
+    dlen = last - pat;
+    for (i = 0; i < dlen && !strchr("*?[", pat[i]); i += pat[i] == '\\' ? 2 : 1)
+        ;
+    if (i < dlen) {
+        if (glob(pat, GLOB_NOSORT, NULL, &g) == 0) {
+            for (n = 0; n < g.gl_pathc; n++) {
+                word_add(g.gl_pathv[n], strlen(g.gl_pathv[n]));
+                push_word(word_end());
+            }
+        }
+        globfree(&g);
+    } else {
+        word_add(pat, dlen);
+        dir = word_end();
+        unescape(dir);
+        dlen = strlen(dir);
+        len = strlen(last);
+        pre = strcspn(last, "*?[\\");
+        suf = 0;
+        if (strpbrk(last, "[\\") == NULL)
+            while (suf < len && last[len - 1 - suf] != '*' && last[len - 1 - suf] != '?')
+                suf++;
+        simple = last[pre] == '*' && pre + 1 + suf == len;
+        if ((dp = opendir(dlen ? dir : ".")) != NULL) {
+            while ((de = readdir(dp)) != NULL) {
+                name = de->d_name;
+                if (name[0] == '.' && (last[0] != '.' || !strcmp(name, ".") || !strcmp(name, "..")))
+                    continue;
+                n = strlen(name);
+                if (n < pre + suf || memcmp(name, last, pre) || memcmp(name + n - suf, last + len - suf, suf))
+                    continue;
+                if (!simple && fnmatch(last, name, FNM_PERIOD) != 0)
+                    continue;
+                word_add(dir, dlen);
+                word_add(name, n);
+                push_word(word_end());
+            }
+            closedir(dp);
+        }
+    }
+    if (nwords == first) { /* No match: the pattern is the word */
+        w = pat;
+        unescape(w);
+        push_word(w);
+        return;
+    }
+    qsort(words + first, nwords - first, sizeof(char *), name_cmp);
+}
+
+/*
+ * parseline - Parse the command line and build the argv array. Words
+ * are split at unquoted spaces, tabs and operators. '...' is literal;
+ * "..." allows $ expansions and \ before \ " $ `; \ quotes the next
+ * character. Unquoted *, ? and [...] expand to the matching names.
+ * A word that expands to nothing, unquoted, is dropped. An unquoted #
+ * starts a comment.
+ */
+int parseline(char *buf, char ***argvp) 
 {
-    char *delim;         /* Points to first space delimiter */
-    int argc;            /* Number of args */
+    char *op = ops, *p = buf, *w;
+    int ntok = 0;        /* Words and operators before globbing */
     int bg;              /* Background job? */
+    int n, quoted, amp = 0;
+
+    arena_reset();
+    if (words == NULL) {
+        words_size = MAXARGS;
+        words = Malloc(words_size * sizeof(char *));
+    }
+    nwords = 0;
+    *argvp = words;
+    for (;;) {
+	while (*p == ' ' || *p == '\t' || *p == '\n')
+	    p++;
+	if (*p == '\0' || *p == '#') /* A comment, or the #! line of a script */
+	    break;
+	if (ntok++ >= MAXARGS - 2) {
+	    printf("Too many arguments\n");
+	    words[0] = NULL;
+	    return 1;
+	}
+	if ((n = *p == '|' ? 1 : redir_len(p)) > 0) {
+	    push_word(op);
+	    memcpy(op, p, n);
+	    op[n] = '\0';
+	    op += n + 1;
+	    p += n;
+	    amp = 0;
+	    continue;
+	}
 
-    buf[strlen(buf)-1] = ' ';  /* Replace trailing '\n' with space */
-    while (*buf && (*buf == ' ')) /* Ignore leading spaces */
-	buf++;
+	/* A word, in the glob pattern form word_lit makes */
+	quoted = word_glob = 0;
+	amp = *p == '&';
+	while (*p && !strchr(" \t\n|<>", *p)) {
+	    if (*p == '\\' && p[1]) {
+		quoted = 1;
+		word_lit(p[1]);
+		p += 2;
+	    } else if (*p == '\'' || *p == '"') {
+		char q = *p++;
 
-    /* Build the argv list */
-    argc = 0;
-    while ((delim = strchr(buf, ' '))) {
-	argv[argc++] = buf;
-	*delim = '\0';
-	buf = delim + 1;
-	while (*buf && (*buf == ' ')) /* Ignore spaces */
-            buf++;
+		quoted = 1;
+		for (; *p && *p != q; p++) {
+		    if (q == '"' && *p == '$') {
+			p = expand_var(p, 1) - 1;
+		    } else {
+			if (q == '"' && *p == '\\' && p[1] && strchr("\\\"$`", p[1]))
+			    p++;
+			word_lit(*p);
+		    }
+		}
+		if (*p == '\0') {
+		    printf("unterminated %c\n", q);
+		    words[0] = NULL;
+		    return 1;
+		}
+		p++;
+	    } else if (*p == '$') {
+		p = expand_var(p, 0);
+	    } else {
+		word_glob |= *p == '*' || *p == '?' || *p == '[';
+		word_add(p++, 1);
+	    }
+	}
+	if (word_len == 0 && !quoted) { /* $EMPTY */
+	    amp = 0;
+	    continue;
+	}
+	w = word_end();
+	if (word_glob) {
+	    expand_glob(w);
+	} else {
+	    unescape(w);
+	    push_word(w);
+	}
+	amp &= !quoted;
     }
-    argv[argc] = NULL;
+    push_word(NULL);
+    nwords--;
+    *argvp = words; /* push_word may have moved it */
     
-    if (argc == 0)  /* Ignore blank line */
+    if (nwords == 0)  /* Ignore blank line */
 	return 1;
 
     /* Should the job run in the background? */
-    if ((bg = (*argv[argc-1] == '&')) != 0)
-	argv[--argc] = NULL;
+    if ((bg = amp) != 0)
+	words[--nwords] = NULL;
 
     return bg;
 }
 /* $end parseline */
 
+/* $begin cache */
+/*
+ * The cached prefix: a command whose output depends only on its words
+ * and the files they name is run once; later runs with the same inputs
+ * replay its stdout and exit status from a file, and start nothing.
+ * Entries live in $SHELLEX_CACHE, else ~/.cache/shellex, one file per
+ * key named by its hash: a header with the exit status and the key,
+ * then the output. stderr is not kept. One cached command runs at a
+ * time, so its state is kept here; while it is stopped, others just run.
+ */
+static struct {
+    int fd;            /* Entry being written, or -1 */
+    int out;           /* Where the output goes once the command is done */
+    size_t len;        /* Of the key */
+    job_t *job;        /* The job, once it has stopped; NULL until then */
+    char path[MAXLINE], tmp[MAXLINE + 16]; /* tmp is path.pid */
+} cache = { -1, -1 };
+
+/* key_stat - add the identity of the file at path to the key: it changes when the file does */
+static void key_stat(char *path, struct stat *st)
+{
+    char id[128];
+
+    snprintf(id, sizeof(id), "%s %lu %lu %lld %lld.%09ld", S_ISDIR(st->st_mode) ? "dir" : "file",
+             (unsigned long)st->st_dev, (unsigned long)st->st_ino, (long long)st->st_size,
+             (long long)st->st_mtim.tv_sec, st->st_mtim.tv_nsec);
+    word_add(path, strlen(path) + 1);
+    word_add(id, strlen(id) + 1);
+}
+
+/*
+ * cache_key - build, in the word arena, what the output of argv may
+ * depend on as far as the shell can tell: the words, the working
+ * directory, and the identity of the program, of every word that names
+ * a file or directory, and of the file stdin is redirected from. A
+ * file's identity is its device, inode, size and mtime to the
+ * nanosecond, which is what make trusts too; contents are not read.
+ * The shell's own stdin is taken not to be read: cached is the user's
+ * word that the command is a function of its files. Returns NULL if
+ * stdin is redirected from anything but a file, e.g. a here-document.
+ */
+static char *cache_key(char **argv, int in, size_t *len)
+{
+    char cwd[MAXLINE], *prog;
+    struct stat st;
+    int i;
 
+    if (in != STDIN_FILENO) {
+        if (fstat(in, &st) < 0 || !S_ISREG(st.st_mode))
+            return NULL;
+        snprintf(cwd, sizeof(cwd), "<%lld", (long long)lseek(in, 0, SEEK_CUR));
+        key_stat(cwd, &st);
+    }
+    if (getcwd(cwd, sizeof(cwd)) != NULL)
+        word_add(cwd, strlen(cwd) + 1);
+    if ((prog = find_command(argv[0])) != NULL && stat(prog, &st) == 0)
+        key_stat(prog, &st);
+    for (i = 0; argv[i] != NULL; i++) {
+        word_add(argv[i], strlen(argv[i]) + 1);
+        if (i > 0 && stat(argv[i], &st) == 0)
+            key_stat(argv[i], &st);
+    }
+    *len = word_len;
+    return word_end();
+}
+
+/* copy_out - copy the rest of fd to out; in the kernel when sendfile can */
+static void copy_out(int out, int fd)
+{
+    char buf[READ_BLOCK];
+    ssize_t n;
+
+    while ((n = sendfile(out, fd, NULL, 1 << 30)) > 0)
+        ;
+    if (n < 0 && (errno == EINVAL || errno == ENOSYS))
+        while ((n = read(fd, buf, sizeof(buf))) > 0 && write(out, buf, n) == n)
+            ;
+}
+
+/*
+ * cache_begin - for the stage argv with descriptors io, after its
+ * redirections: replay a stored run if there is one and return 1.
+ * Otherwise point io[1] at a new entry and return 0; cache_end
+ * finishes it. Returns -1 if the command cannot be cached; it just runs.
+ */
+int cache_begin(char **argv, int *io)
+{
+    char head[CACHE_HEAD + 1], *key, *stored, *dir, *slash;
+    unsigned long long h = 14695981039346656037ULL; /* FNV-1a */
+    size_t len, n, i;
+    int fd, status;
+
+    if (cache.fd >= 0) /* The entry of a stopped job is still open */
+        return -1;
+    if ((key = cache_key(argv, io[0], &len)) == NULL)
+        return -1;
+    for (i = 0; i < len; i++)
+        h = (h ^ (unsigned char)key[i]) * 1099511628211ULL;
+    if ((dir = getenv("SHELLEX_CACHE")) != NULL)
+        n = snprintf(cache.path, sizeof(cache.path), "%s", dir);
+    else if ((dir = getenv("HOME")) != NULL)
+        n = snprintf(cache.path, sizeof(cache.path), "%s/.cache/shellex", dir);
+    else
+        return -1;
+    snprintf(cache.path + n, sizeof(cache.path) - n, "/%016llx", h);
+
+    /* A hit: same key, not just the same hash */
+    if ((fd = open(cache.path, O_RDONLY | O_CLOEXEC)) >= 0) {
+        if (read(fd, head, CACHE_HEAD) == CACHE_HEAD && !memcmp(head, CACHE_MAGIC, sizeof(CACHE_MAGIC) - 1)) {
+            head[CACHE_HEAD] = '\0';
+            if (sscanf(head + sizeof(CACHE_MAGIC) - 1, "%d %zu", &status, &n) == 2 && n == len) {
+                stored = Malloc(len);
+                if (read(fd, stored, len) == len && !memcmp(stored, key, len)) {
+                    free(stored);
+                    fflush(stdout);
+                    copy_out(io[1], fd);
+                    close(fd);
+                    last_status = status;
+                    return 1;
+                }
+                free(stored);
+            }
+        }
+        close(fd);
+    }
+
+    /* A miss: the output goes to a new entry, put in place only when complete */
+    dir = strrchr(cache.path, '/');
+    *dir = '\0';
+    if (mkdir(cache.path, 0755) < 0 && errno == ENOENT) { /* ~/.cache too */
+        if ((slash = strrchr(cache.path, '/')) != NULL) {
+            *slash = '\0';
+            mkdir(cache.path, 0755);
+            *slash = '/';
+        }
+        mkdir(cache.path, 0755);
+    }
+    *dir = '/';
+    snprintf(cache.tmp, sizeof(cache.tmp), "%s.%d", cache.path, (int)getpid());
+    if ((fd = open(cache.tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+        return -1;
+    snprintf(head, sizeof(head), "%s%3s %20zu\n", CACHE_MAGIC, "", len);
+    if (write(fd, head, CACHE_HEAD) != CACHE_HEAD || write(fd, key, len) != len) {
+        close(fd);
+        unlink(cache.tmp);
+        return -1;
+    }
+    cache.fd = fd;
+    cache.len = len;
+    cache.out = fcntl(io[1], F_DUPFD_CLOEXEC, 3); /* io[1] may be closed when the stage starts */
+    io[1] = fd;
+    return 0;
+}
+
+/*
+ * cache_end - finish the entry of the cached command's job once it has
+ * ended: keep the entry if it exited, then show its output. job is NULL
+ * if nothing ran, and the entry is dropped. A stopped job keeps its
+ * entry open, and fg or report_jobs calls this again when it is over.
+ */
+void cache_end(job_t *job)
+{
+    char code[4];
+    int status;
+
+    if (cache.fd < 0 || (cache.job != NULL && job != cache.job))
+        return;
+    if (job != NULL && job->state != UNDEF && job->state != DONE) {
+        cache.job = job;
+        return;
+    }
+    status = job != NULL ? job->status[job->nprocs - 1] : -1;
+    if (status != -1 && WIFEXITED(status)) {
+        snprintf(code, sizeof(code), "%3d", WEXITSTATUS(status));
+        pwrite(cache.fd, code, 3, sizeof(CACHE_MAGIC) - 1);
+        rename(cache.tmp, cache.path);
+    } else {
+        unlink(cache.tmp);
+    }
+    if (status != -1) {
+        lseek(cache.fd, CACHE_HEAD + cache.len, SEEK_SET);
+        copy_out(cache.out, cache.fd);
+    }
+    close(cache.fd);
+    close(cache.out);
+    cache.fd = cache.out = -1;
+    cache.job = NULL;
+}
+/* $end cache */
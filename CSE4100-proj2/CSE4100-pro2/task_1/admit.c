@@ -0,0 +1,81 @@
+/*
+ * admit.c - lock-free token buckets and connection accounting
+ */
+#include "csapp.h"
+#include "admit.h"
+
+static bucket_t addr_buckets[ADDR_SLOTS];   //Colliding addresses share a bucket
+static int active_conns = 0;
+
+/* now_usec - monotonic clock, served by the vDSO without a syscall */
+unsigned long now_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+/*
+ * bucket_take - take one token, 0 if the bucket is empty.
+ * Refill is implicit: the arrival time never falls behind now.
+ */
+int bucket_take(bucket_t *b, long rate, long burst)
+{
+    unsigned long now = now_usec();
+    unsigned long interval = 1000000 / rate;
+    unsigned long tat, newtat;
+
+    tat = __atomic_load_n(b, __ATOMIC_RELAXED);
+    do {
+        newtat = ((tat > now) ? tat : now) + interval;
+        if (newtat > now + burst * interval)
+            return 0;
+    } while (!__atomic_compare_exchange_n(b, &tat, newtat, 1,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return 1;
+}
+
+/* addr_slot - FNV-1a hash of the peer address (not the port) */
+int addr_slot(struct sockaddr_storage *addr)
+{
+    unsigned char *p;
+    size_t i, n;
+    unsigned int h = 2166136261u;
+
+    if (addr->ss_family == AF_INET6) {
+        p = (unsigned char *)&((struct sockaddr_in6 *)addr)->sin6_addr;
+        n = sizeof(struct in6_addr);
+    } else {
+        p = (unsigned char *)&((struct sockaddr_in *)addr)->sin_addr;
+        n = sizeof(struct in_addr);
+    }
+    for (i = 0; i < n; i++)
+        h = (h ^ p[i]) * 16777619u;
+    return h & (ADDR_SLOTS - 1);
+}
+
+int addr_take(int slot)
+{
+    return bucket_take(&addr_buckets[slot], ADDR_RATE, ADDR_BURST);
+}
+
+/* conn_admit - count a new connection, 0 if max_conns are already open */
+int conn_admit(int max_conns)
+{
+    if (__atomic_fetch_add(&active_conns, 1, __ATOMIC_RELAXED) >= max_conns) {
+        __atomic_fetch_sub(&active_conns, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    return 1;
+}
+
+void conn_release(void)
+{
+    __atomic_fetch_sub(&active_conns, 1, __ATOMIC_RELAXED);
+}
+
+int conn_active(void)
+{
+    return __atomic_load_n(&active_conns, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,301 @@
+/*
+ * feed.c - sequenced UDP market-data feed served from a fan-out process
+ *
+ * Trading server -> (pipe, feed_event) -> fan-out process
+ *     -> UDP multicast feed_msg, sequenced, heartbeated when idle
+ *     -> TCP "replay <seq>\n" / "snapshot\n" for gap recovery
+ */
+#include "csapp.h"
+#include "feed.h"
+
+typedef struct {
+    int id;
+    int left_stock;
+    int price;
+} feed_level;
+
+typedef struct {    //Record written by the trading server, never crosses the network
+    int type;
+    int id;
+    int qty;
+    int left_stock;
+    int price;
+} feed_event;
+
+static feed_level *levels = NULL;   //Fan-out's mirror of the stock table, sorted by id
+static int num_levels = 0;
+static int max_levels = 0;
+static int feed_fd = -1;            //Write end of the pipe, -1 until feed_start
+
+static feed_msg *history;           //history[seq % FEED_HISTORY]
+static uint32_t last_seq = 0;
+
+static void fanout(int rfd, int udp_port, int tcp_port);
+static void publish(int udpfd, struct sockaddr_in *group, feed_msg *msg);
+static void serve_recovery(int connfd);
+static void send_snapshot(int connfd);
+static void send_msgs(int connfd, feed_msg *msgs, int n);
+static int level_cmp(const void *a, const void *b);
+static feed_level *find_level(int id);
+
+/* feed_add_stock - record the initial level of a stock before feed_start */
+void feed_add_stock(int id, int left_stock, int price)
+{
+    if (num_levels == max_levels) {
+        max_levels = max_levels ? 2 * max_levels : 128;
+        levels = Realloc(levels, max_levels * sizeof(feed_level));
+    }
+    levels[num_levels].id = id;
+    levels[num_levels].left_stock = left_stock;
+    levels[num_levels].price = price;
+    num_levels++;
+}
+
+/* feed_start - fork the fan-out process; it exits when the server closes the pipe */
+void feed_start(int udp_port, int tcp_port)
+{
+    int fds[2];
+
+    qsort(levels, num_levels, sizeof(feed_level), level_cmp);
+    if (pipe(fds) < 0)
+        unix_error("feed_start: pipe error");
+
+    if (Fork() == 0) {
+        Close(fds[1]);
+        fanout(fds[0], udp_port, tcp_port);
+        exit(0);
+    }
+    Close(fds[0]);
+    feed_fd = fds[1];
+}
+
+/*
+ * feed_publish - hand a trade to the fan-out process. Callers publish
+ * while still holding the item, so the fan-out sees levels in order.
+ * A feed_event is smaller than PIPE_BUF, so concurrent writes never interleave.
+ */
+void feed_publish(int type, int id, int qty, int left_stock, int price)
+{
+    feed_event ev;
+
+    if (feed_fd < 0)
+        return;
+    ev.type = type;
+    ev.id = id;
+    ev.qty = qty;
+    ev.left_stock = left_stock;
+    ev.price = price;
+    if (rio_writen(feed_fd, &ev, sizeof(ev)) != sizeof(ev)) {
+        fprintf(stderr, "feed_publish: fan-out process is gone, feed disabled\n");
+        Close(feed_fd);
+        feed_fd = -1;
+    }
+}
+
+/* feed_pipe - write end of the pipe, passed on to a replacement server */
+int feed_pipe(void)
+{
+    return feed_fd;
+}
+
+/* feed_adopt - publish into the fan-out process of the server we replaced */
+void feed_adopt(int fd)
+{
+    feed_fd = fd;
+}
+
+/* feed_subscribe - open a UDP socket joined to the feed group */
+int feed_subscribe(int udp_port)
+{
+    int udpfd, optval = 1;
+    struct sockaddr_in addr;
+    struct ip_mreq mreq;
+
+    udpfd = Socket(AF_INET, SOCK_DGRAM, 0);
+    Setsockopt(udpfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(int));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(udp_port);
+    Bind(udpfd, (SA *)&addr, sizeof(addr));
+
+    Inet_pton(AF_INET, FEED_GROUP, &mreq.imr_multiaddr);
+    Inet_pton(AF_INET, FEED_IFACE, &mreq.imr_interface);
+    Setsockopt(udpfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+    return udpfd;
+}
+
+void feed_ntoh(feed_msg *msg)
+{
+    msg->seq = ntohl(msg->seq);
+    msg->type = ntohl(msg->type);
+    msg->id = ntohl(msg->id);
+    msg->qty = ntohl(msg->qty);
+    msg->left_stock = ntohl(msg->left_stock);
+    msg->price = ntohl(msg->price);
+}
+
+static void fanout(int rfd, int udp_port, int tcp_port)
+{
+    int udpfd, listenfd, connfd, maxfd;
+    unsigned char ttl = 1, loop = 1;
+    struct in_addr iface;
+    struct sockaddr_in group;
+    struct timeval timeout;
+    fd_set ready_set;
+    char port[16];
+    feed_event ev;
+    feed_msg msg;
+    feed_level *level;
+    rio_t rio;
+
+    Signal(SIGINT, SIG_IGN);        //Outlive the server until the pipe drains
+    Signal(SIGCHLD, SIG_IGN);       //Recovery children are reaped by the kernel
+
+    udpfd = Socket(AF_INET, SOCK_DGRAM, 0);
+    Inet_pton(AF_INET, FEED_IFACE, &iface);
+    Setsockopt(udpfd, IPPROTO_IP, IP_MULTICAST_IF, &iface, sizeof(iface));
+    Setsockopt(udpfd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    Setsockopt(udpfd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    memset(&group, 0, sizeof(group));
+    group.sin_family = AF_INET;
+    group.sin_port = htons(udp_port);
+    Inet_pton(AF_INET, FEED_GROUP, &group.sin_addr);
+
+    sprintf(port, "%d", tcp_port);
+    listenfd = Open_listenfd(port);
+    history = Calloc(FEED_HISTORY, sizeof(feed_msg));
+    Rio_readinitb(&rio, rfd);
+    maxfd = (rfd > listenfd) ? rfd : listenfd;
+
+    while (1) {
+        FD_ZERO(&ready_set);
+        FD_SET(rfd, &ready_set);
+        FD_SET(listenfd, &ready_set);
+        timeout.tv_sec = FEED_HB_SEC;
+        timeout.tv_usec = 0;
+
+        if (Select(maxfd + 1, &ready_set, NULL, NULL, &timeout) == 0) {
+            memset(&msg, 0, sizeof(msg));
+            msg.seq = htonl(last_seq);
+            msg.type = htonl(FEED_HEARTBEAT);
+            publish(udpfd, &group, &msg);
+            continue;
+        }
+
+        /* Drain every whole event the server has written so far */
+        if (FD_ISSET(rfd, &ready_set)) {
+            do {
+                if (rio_readnb(&rio, &ev, sizeof(ev)) != sizeof(ev))
+                    exit(0);        //Trading server has exited
+                if ((level = find_level(ev.id)) != NULL) {
+                    level->left_stock = ev.left_stock;
+                    level->price = ev.price;
+                }
+                msg.seq = htonl(++last_seq);
+                msg.type = htonl(ev.type);
+                msg.id = htonl(ev.id);
+                msg.qty = htonl(ev.qty);
+                msg.left_stock = htonl(ev.left_stock);
+                msg.price = htonl(ev.price);
+                history[last_seq % FEED_HISTORY] = msg;
+                publish(udpfd, &group, &msg);
+            } while (rio.rio_cnt >= (int)sizeof(ev));
+        }
+
+        /* Recovery is served by a child, which sees a frozen copy of the book */
+        if (FD_ISSET(listenfd, &ready_set)) {
+            if ((connfd = accept(listenfd, NULL, NULL)) < 0)
+                continue;
+            if (Fork() == 0) {
+                Close(listenfd);
+                serve_recovery(connfd);
+                Close(connfd);
+                exit(0);
+            }
+            Close(connfd);
+        }
+    }
+}
+
+/* publish - best effort; receivers recover lost datagrams over TCP */
+static void publish(int udpfd, struct sockaddr_in *group, feed_msg *msg)
+{
+    sendto(udpfd, msg, sizeof(feed_msg), 0, (SA *)group, sizeof(*group));
+}
+
+static void serve_recovery(int connfd)
+{
+    char buf[MAXLINE];
+    unsigned int from;
+    uint32_t oldest, seq;
+    feed_msg msgs[FEED_BATCH];
+    int n = 0;
+    rio_t rio;
+
+    Rio_readinitb(&rio, connfd);
+    if (rio_readlineb(&rio, buf, MAXLINE) <= 0)
+        return;
+
+    /* Replay if the ring still holds every requested message, else snapshot */
+    oldest = (last_seq >= FEED_HISTORY) ? last_seq - FEED_HISTORY + 1 : 1;
+    if (sscanf(buf, "replay %u", &from) != 1 || from < oldest || from > last_seq + 1) {
+        send_snapshot(connfd);
+        return;
+    }
+    for (seq = from; seq <= last_seq; seq++) {
+        msgs[n++] = history[seq % FEED_HISTORY];
+        if (n == FEED_BATCH) {
+            send_msgs(connfd, msgs, n);
+            n = 0;
+        }
+    }
+    send_msgs(connfd, msgs, n);
+}
+
+static void send_snapshot(int connfd)
+{
+    feed_msg msgs[FEED_BATCH];
+    int i, n = 0;
+
+    memset(msgs, 0, sizeof(msgs));
+    msgs[n].seq = htonl(last_seq);
+    msgs[n].type = htonl(FEED_SNAP_BEGIN);
+    msgs[n++].qty = htonl(num_levels);
+    for (i = 0; i < num_levels; i++) {
+        msgs[n].seq = htonl(last_seq);
+        msgs[n].type = htonl(FEED_LEVEL);
+        msgs[n].id = htonl(levels[i].id);
+        msgs[n].qty = 0;
+        msgs[n].left_stock = htonl(levels[i].left_stock);
+        msgs[n++].price = htonl(levels[i].price);
+        if (n == FEED_BATCH) {
+            send_msgs(connfd, msgs, n);
+            n = 0;
+        }
+    }
+    memset(&msgs[n], 0, sizeof(feed_msg));
+    msgs[n].seq = htonl(last_seq);
+    msgs[n++].type = htonl(FEED_SNAP_END);
+    send_msgs(connfd, msgs, n);
+}
+
+static void send_msgs(int connfd, feed_msg *msgs, int n)
+{
+    if (n > 0)
+        Rio_writen(connfd, msgs, n * sizeof(feed_msg));
+}
+
+static int level_cmp(const void *a, const void *b)
+{
+    int x = ((const feed_level *)a)->id, y = ((const feed_level *)b)->id;
+    return (x > y) - (x < y);
+}
+
+static feed_level *find_level(int id)
+{
+    feed_level key;
+    key.id = id;
+    return bsearch(&key, levels, num_levels, sizeof(feed_level), level_cmp);
+}
@@ -0,0 +1,52 @@
+/*
+ * feed.h - sequenced binary market-data feed
+ *
+ * The stock server hands every trade to a local fan-out process over a
+ * pipe. The fan-out process sequences the trades, publishes them to a
+ * UDP multicast group and serves a TCP snapshot/replay channel that
+ * subscribers use to recover from gaps, so market data never touches
+ * the trading sockets.
+ */
+#ifndef __FEED_H__
+#define __FEED_H__
+
+#include <stdint.h>
+
+#define FEED_GROUP      "239.255.0.1"   /* Multicast group of the feed */
+#define FEED_IFACE      "127.0.0.1"     /* Interface the feed is sent/joined on */
+#define FEED_UDP_OFFSET 1               /* Feed port = trading port + 1 */
+#define FEED_TCP_OFFSET 2               /* Recovery port = trading port + 2 */
+#define FEED_HISTORY    65536           /* Messages kept for replay */
+#define FEED_HB_SEC     1               /* Heartbeat interval when idle */
+#define FEED_BATCH      256             /* Messages per recovery write */
+
+/* Message types */
+#define FEED_BUY        1   /* qty shares bought, left_stock is the new level */
+#define FEED_SELL       2   /* qty shares sold, left_stock is the new level */
+#define FEED_LEVEL      3   /* Snapshot entry for one stock */
+#define FEED_HEARTBEAT  4   /* seq is the last published sequence number */
+#define FEED_SNAP_BEGIN 5   /* qty FEED_LEVEL entries follow, valid as of seq */
+#define FEED_SNAP_END   6
+
+/* Wire format, every field in network byte order */
+typedef struct {
+    uint32_t seq;
+    int32_t type;
+    int32_t id;
+    int32_t qty;
+    int32_t left_stock;
+    int32_t price;
+} feed_msg;
+
+/* Trading server side */
+void feed_add_stock(int id, int left_stock, int price);
+void feed_start(int udp_port, int tcp_port);
+void feed_publish(int type, int id, int qty, int left_stock, int price);
+int feed_pipe(void);
+void feed_adopt(int fd);
+
+/* Subscriber side */
+int feed_subscribe(int udp_port);
+void feed_ntoh(feed_msg *msg);
+
+#endif /* __FEED_H__ */
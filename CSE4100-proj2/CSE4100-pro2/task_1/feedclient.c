@@ -0,0 +1,100 @@
+/*
+ * feedclient.c - market-data feed subscriber
+ *
+ * Starts from a TCP snapshot, then follows the UDP feed. A sequence
+ * gap (or a heartbeat ahead of us) triggers a TCP replay of the
+ * missing messages.
+ */
+#include "csapp.h"
+#include "feed.h"
+
+uint32_t recover(char *host, char *port, uint32_t from);
+void print_msg(feed_msg *msg);
+
+int main(int argc, char **argv)
+{
+    int udpfd;
+    char *host, port[16];
+    uint32_t expected;
+    feed_msg msg;
+
+    if (argc != 3) {
+	fprintf(stderr, "usage: %s <host> <port>\n", argv[0]);
+	exit(0);
+    }
+    host = argv[1];
+    sprintf(port, "%d", atoi(argv[2]) + FEED_TCP_OFFSET);
+
+    /* Join before the snapshot so nothing published after it is missed */
+    udpfd = feed_subscribe(atoi(argv[2]) + FEED_UDP_OFFSET);
+    expected = recover(host, port, 0) + 1;
+
+    while (recv(udpfd, &msg, sizeof(msg), 0) == sizeof(msg)) {
+        feed_ntoh(&msg);
+        if (msg.type == FEED_HEARTBEAT) {
+            if (msg.seq >= expected)
+                expected = recover(host, port, expected) + 1;
+            continue;
+        }
+        if (msg.seq < expected)         //Already applied from a replay
+            continue;
+        if (msg.seq > expected) {
+            printf("gap: expected %u, got %u\n", expected, msg.seq);
+            expected = recover(host, port, expected) + 1;
+            continue;
+        }
+        print_msg(&msg);
+        expected = msg.seq + 1;
+    }
+    Close(udpfd);
+    exit(0);
+}
+
+/*
+ * recover - replay from seq 'from' (0 asks for a snapshot) and return
+ * the last sequence number the server's answer covers
+ */
+uint32_t recover(char *host, char *port, uint32_t from)
+{
+    int clientfd;
+    char buf[MAXLINE];
+    uint32_t last = (from > 0) ? from - 1 : 0;
+    feed_msg msg;
+    rio_t rio;
+
+    clientfd = Open_clientfd(host, port);
+    if (from > 0)
+        sprintf(buf, "replay %u\n", from);
+    else
+        sprintf(buf, "snapshot\n");
+    Rio_writen(clientfd, buf, strlen(buf));
+
+    Rio_readinitb(&rio, clientfd);
+    while (Rio_readnb(&rio, &msg, sizeof(msg)) == sizeof(msg)) {
+        feed_ntoh(&msg);
+        if (msg.type == FEED_SNAP_BEGIN || msg.type == FEED_SNAP_END || msg.seq > last)
+            last = msg.seq;
+        print_msg(&msg);
+    }
+    Close(clientfd);
+    return last;
+}
+
+void print_msg(feed_msg *msg)
+{
+    switch (msg->type) {
+    case FEED_BUY:
+        printf("%u buy %d %d -> %d %d\n", msg->seq, msg->id, msg->qty, msg->left_stock, msg->price);
+        break;
+    case FEED_SELL:
+        printf("%u sell %d %d -> %d %d\n", msg->seq, msg->id, msg->qty, msg->left_stock, msg->price);
+        break;
+    case FEED_LEVEL:
+        printf("%d %d %d\n", msg->id, msg->left_stock, msg->price);
+        break;
+    case FEED_SNAP_BEGIN:
+        printf("snapshot at %u, %d stocks\n", msg->seq, msg->qty);
+        break;
+    }
+    fflush(stdout);
+}
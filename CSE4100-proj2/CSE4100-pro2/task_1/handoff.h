@@ -0,0 +1,28 @@
+/*
+ * handoff.h - pass a running server's sockets to its replacement
+ *
+ *   new server                          old server
+ *   handoff_connect()  ------------->   accept() on handoff_listen()
+ *   handoff_recv()     <-------------   handoff_send(listenfd, feed pipe)
+ *                                       stop accepting, drain, save stock file
+ *   handoff_wait()     <-------------   handoff_done()
+ *   load stock file, serve the same listening socket
+ *
+ * Connections arriving in between wait in the listen backlog, so none
+ * are refused during an upgrade.
+ */
+#ifndef __HANDOFF_H__
+#define __HANDOFF_H__
+
+#define HANDOFF_PATH "stockserver-%s.sock"  /* Control socket, per trading port */
+#define HANDOFF_MAXFDS 2
+
+int handoff_listen(char *port);
+void handoff_unlink(char *port);
+int handoff_connect(char *port);
+int handoff_send(int connfd, int *fds, int n);
+int handoff_recv(int connfd, int *fds, int n);
+void handoff_done(int connfd);
+void handoff_wait(int connfd);
+
+#endif /* __HANDOFF_H__ */
@@ -2,19 +2,53 @@
  * echoserveri.c - An iterative echo server 
  */ 
 /* $begin echoserverimain */
+#include <limits.h>
+#include <sys/signalfd.h>
 #include "csapp.h"
+#include "feed.h"
+#include "admit.h"
+#include "timer.h"
+#include "handoff.h"
 
-#define MAX_STOCKS 100
+#define MAX_STOCKS 100000
 #define FILENAME "stock.txt"
+#define MAX_CONNS (FD_SETSIZE - 64)     //Open client connections
+#define BUSY_MSG "server busy\n"
+#define RATE_MSG "rate limited\n"
+#define TIMEOUT_IDLE 0          //No request in progress
+#define TIMEOUT_READ 1          //Part of the next request is already buffered
+#define IDLE_TIMEOUT_MS 60000
+#define READ_TIMEOUT_MS 5000    //From the first byte of a request to its newline
+#define WRITE_TIMEOUT_MS 5000   //Bounds any single blocking write
+#define IDX_VOLUME 0        //Secondary index by traded volume, descending
+#define IDX_LEFT 1          //Secondary index by left_stock, ascending
+#define NUM_INDEXES 2
+#define REPLY_MORE "...\n"  //Ends a reply that did not fit in MAXLINE
 
 typedef struct stock_item {
     int id;
     int left_stock;
     int price;
+    int volume;                 //Shares bought and sold so far
+    struct index_entry *entry[NUM_INDEXES];   //Node in each secondary index
     struct stock_item *left;
     struct stock_item *right;
 } stock_item;
 
+typedef struct index_entry {
+    int key;                //Copy of the indexed field
+    int prio;               //Random heap priority that keeps the treap balanced
+    stock_item *item;
+    struct index_entry *left;
+    struct index_entry *right;
+} index_entry;
+
+typedef struct {            //Treap of items by one field, ties broken by id
+    index_entry *entries;
+    index_entry *root;
+    int desc;
+} stock_index;
+
 typedef struct {    //Represent a pool of connected descriptors
     int maxfd;      //Largest descriptor in read_set
     fd_set read_set;    //Set of all active descriptors (client_fd + listen_fd)
@@ -22,7 +56,11 @@ typedef struct {    //Represent a pool of connected descriptors
     int nready;         //Numver o fready descriptors from select
     int maxi;           //High water index into client array
     int clientfd[FD_SETSIZE];       //Set of active descriptors
-    rio_t clientrio[FD_SETSIZE];    //Set of active read buffers
+    char inbuf[FD_SETSIZE][MAXLINE];    //Bytes received but not yet served
+    int incnt[FD_SETSIZE];              //Bytes in inbuf
+    bucket_t bucket[FD_SETSIZE];    //Per-connection request bucket
+    int addr_slot[FD_SETSIZE];      //Per-address bucket of the peer
+    tw_timer timer[FD_SETSIZE];     //Idle/read timeout of each client
 } pool;
 
 int byte_cnt = 0;
@@ -30,64 +68,170 @@ int num_stocks;
 struct timeval start;	/* starting time */
 struct timeval end;	/* ending time */
 unsigned long e_usec;	/* elapsed microseconds */
+tw_wheel wheel;         //Timeouts of every client in the pool
 struct stock_item *root = NULL;
 struct stock_item *stocks[MAX_STOCKS];
-
-void sigint_handler(int signum);
-
+stock_index indexes[NUM_INDEXES];
+int draining = 0;       //Shutting down or handing off; no new requests
 void echo(int connfd);
 void init_pool(int listenfd, pool *p, char *filename);
-void add_client(int connfd, pool *p);
+void add_client(int connfd, int addr_slot, pool *p);
+void reject(int connfd, char *msg);
 void check_clients(pool *p);
-void remove_client(int fd);
+void start_drain(pool *p);
+void remove_client(pool *p, int i);
+void client_timeout(tw_timer *t);
+void arm_timer(pool *p, int i);
+void set_socket_timeouts(int listenfd);
 void handle_client_request(int fd, char *buf);
+void send_reply(int fd, char *buf);
 void handle_show_request(int fd);
+void handle_show_query(int fd, char *args);
+int show_range(stock_item *node, int lo, int hi, char *buf, int *len);
+void show_index(int which, int limit, int bound, char *buf, int *len);
+int append_item(stock_item *item, char *buf, int *len);
 void handle_buy_request(int fd, int id, int num);
 void handle_sell_request(int fd, int id, int num);
 void update_stock_file(char *filename);
-stock_item* insertItem(stock_item* node, stock_item* item);
+stock_item* build_tree(stock_item **items, int n);
 stock_item* findStockById(int id);
+void build_index(int which, int desc);
+void update_index(int which, stock_item *item, int key);
+void reindex(stock_item *item);
 
 
 int main(int argc, char **argv) 
 {
-    int listenfd, connfd;
+    int n, listenfd, connfd, ctlfd, sigfd, succfd = -1;
+    int fds[HANDOFF_MAXFDS];
+    long timeout_ms;
+    struct timeval timeout;
     socklen_t clientlen;
     struct sockaddr_storage clientaddr;  /* Enough space for any address */  //line:netp:echoserveri:sockaddrstorage
     char client_hostname[MAXLINE], client_port[MAXLINE];
+    struct signalfd_siginfo si;
+    sigset_t mask;
     static pool pool;
 
-    if (argc != 2) {
-	fprintf(stderr, "usage: %s <port>\n", argv[0]);
+    if (argc != 2 && !(argc == 3 && !strcmp(argv[2], "-takeover"))) {
+	fprintf(stderr, "usage: %s <port> [-takeover]\n", argv[0]);
+	fprintf(stderr, "market data: udp %s:<port>+%d, recovery tcp <port>+%d\n",
+		FEED_GROUP, FEED_UDP_OFFSET, FEED_TCP_OFFSET);
 	exit(0);
     }
 
-    listenfd = Open_listenfd(argv[1]);
+    /* -takeover: inherit the listening socket and feed of the running server */
+    n = 0;
+    if (argc == 3) {
+        if ((ctlfd = handoff_connect(argv[1])) < 0)
+            app_error("no running server to take over");
+        if ((n = handoff_recv(ctlfd, fds, HANDOFF_MAXFDS)) == 0)
+            app_error("handoff refused");
+        listenfd = fds[0];
+        handoff_wait(ctlfd);    //Its stock file is complete after this
+    } else {
+        listenfd = Open_listenfd(argv[1]);
+    }
+    set_socket_timeouts(listenfd);
+    tw_init(&wheel, now_usec() / 1000);
     init_pool(listenfd, &pool, FILENAME);
-    Signal(SIGINT, sigint_handler);
-
-    while (1) {
+    if (n == HANDOFF_MAXFDS)
+        feed_adopt(fds[1]);
+    else
+        feed_start(atoi(argv[1]) + FEED_UDP_OFFSET, atoi(argv[1]) + FEED_TCP_OFFSET);
+    Signal(SIGPIPE, SIG_IGN);       //A vanished client fails its write instead
+
+    /* SIGINT/SIGTERM arrive as readable data, so shutdown runs in the loop, not a handler */
+    Sigemptyset(&mask);
+    Sigaddset(&mask, SIGINT);
+    Sigaddset(&mask, SIGTERM);
+    Sigprocmask(SIG_BLOCK, &mask, NULL);
+    if ((sigfd = signalfd(-1, &mask, 0)) < 0)
+        unix_error("signalfd error");
+    ctlfd = handoff_listen(argv[1]);
+    FD_SET(sigfd, &pool.read_set);
+    FD_SET(ctlfd, &pool.read_set);
+    if (sigfd > pool.maxfd) pool.maxfd = sigfd;
+    if (ctlfd > pool.maxfd) pool.maxfd = ctlfd;
+
+    /* Every client left while draining has a read timer, so this ends */
+    while (!draining || conn_active() > 0) {
         /* Wait for listening/connected descriptor(s) to become ready*/
         pool.ready_set = pool.read_set;
-        pool.nready = Select(pool.maxfd+1, &pool.ready_set, NULL, NULL, NULL);
-        /* If listening descriptor ready, add new client to pool*/
-        if (FD_ISSET(listenfd, &pool.ready_set)) {
+        /* Sleep no longer than the next timer tick */
+        timeout_ms = tw_timeout(&wheel, now_usec() / 1000);
+        timeout.tv_sec = timeout_ms / 1000;
+        timeout.tv_usec = (timeout_ms % 1000) * 1000;
+        pool.nready = Select(pool.maxfd+1, &pool.ready_set, NULL, NULL, (timeout_ms < 0) ? NULL : &timeout);
+        tw_advance(&wheel, now_usec() / 1000);
+
+        if (FD_ISSET(sigfd, &pool.ready_set)) {
+            pool.nready--;
+            Read(sigfd, &si, sizeof(si));
+            printf("signal %d, shutting down\n", si.ssi_signo);
+            start_drain(&pool);
+        } else if (FD_ISSET(ctlfd, &pool.ready_set)) {
+            /* A replacement server asks for our sockets; stop accepting once it has them */
+            pool.nready--;
+            if ((succfd = accept(ctlfd, NULL, NULL)) >= 0) {
+                fds[0] = listenfd;
+                fds[1] = feed_pipe();
+                if (handoff_send(succfd, fds, (fds[1] >= 0) ? 2 : 1) == 0) {
+                    printf("handing off to a new server\n");
+                    start_drain(&pool);
+                } else {
+                    Close(succfd);
+                    succfd = -1;
+                }
+            }
+        }
+
+        if (draining) {
+            FD_CLR(listenfd, &pool.read_set);
+            FD_CLR(sigfd, &pool.read_set);
+            FD_CLR(ctlfd, &pool.read_set);
+        } else if (FD_ISSET(listenfd, &pool.ready_set)) {
+            /* If listening descriptor ready, add new client to pool*/
             clientlen = sizeof(struct sockaddr_storage);
             connfd = Accept(listenfd, (SA *)&clientaddr, &clientlen);
-            Getnameinfo((SA *)&clientaddr, clientlen, client_hostname, MAXLINE, client_port, MAXLINE, 0);
-			printf("Connected to (%s, %s)\n", client_hostname, client_port);
-            add_client(connfd, &pool);
+            /* Turn clients away before any per-client work; select can't watch fds past FD_SETSIZE */
+            if (connfd >= FD_SETSIZE || !conn_admit(MAX_CONNS)) {
+                pool.nready--;
+                reject(connfd, BUSY_MSG);
+            } else {
+                Getnameinfo((SA *)&clientaddr, clientlen, client_hostname, MAXLINE, client_port, MAXLINE, 0);
+                printf("Connected to (%s, %s)\n", client_hostname, client_port);
+                add_client(connfd, addr_slot(&clientaddr), &pool);
+            }
         }
         check_clients(&pool);
     }
+
+    Close(listenfd);        //A successor holds its own copy
+    Close(ctlfd);
+    if (succfd < 0)
+        handoff_unlink(argv[1]);
     update_stock_file(FILENAME);
+    if (succfd >= 0)
+        handoff_done(succfd);
     exit(0);
 }
 /* $end echoserverimain */
 
-void sigint_handler(int signum){
-    update_stock_file(FILENAME);
-    exit(0);
+/*
+ * start_drain - stop taking requests. Idle clients are closed now; a
+ * client that is ready or has part of a request buffered is closed
+ * after its reply (see check_clients).
+ */
+void start_drain(pool *p) {
+    int i;
+
+    draining = 1;
+    for (i = 0; i <= p->maxi; i++) {
+        if (p->clientfd[i] >= 0 && p->incnt[i] == 0 &&
+            !FD_ISSET(p->clientfd[i], &p->ready_set))
+            remove_client(p, i);
+    }
 }
 
 void init_pool(int listenfd, pool *p, char *filename) {
@@ -127,26 +271,40 @@ void init_pool(int listenfd, pool *p, char *filename) {
             continue;
         }
         int price = atoi(token);
+        if (num_stocks == MAX_STOCKS - 1) { /* stocks[] is 1-based */
+            fprintf(stderr, "%s: more than %d stocks, the rest are not loaded\n", filename, MAX_STOCKS - 1);
+            break;
+        }
         // printf("id : %d, left_stock : %d, price : %d\n", id, left_stock, price);
         stock_item *item = (struct stock_item*)malloc(sizeof(stock_item));
         item->id = id;
         item->left_stock = left_stock; 
         item->price = price;
+        item->volume = 0;
         stocks[++num_stocks] = item;
-        root = insertItem(root, item);
+        feed_add_stock(id, left_stock, price);
     }
 
     fclose(fp);
+    root = build_tree(&stocks[1], num_stocks);
+    build_index(IDX_VOLUME, 1);
+    build_index(IDX_LEFT, 0);
 }
 
-void add_client(int connfd, pool *p) {
+void add_client(int connfd, int addr_slot, pool *p) {
     int i;
     p->nready--;
     for (i = 0; i < FD_SETSIZE; i++) {      //Find available slot
         if (p->clientfd[i] < 0) {
             /* Add connected descriptor to the poll */
             p->clientfd[i] = connfd;
-            Rio_readinitb(&p->clientrio[i], connfd);
+            p->incnt[i] = 0;
+            p->bucket[i] = 0;
+            p->addr_slot[i] = addr_slot;
+            p->timer[i].expire = client_timeout;
+            p->timer[i].data = p;
+            p->timer[i].arg = i;
+            arm_timer(p, i);
 
             /* Add the descriptor to descriptor set */
             FD_SET(connfd, &p->read_set);
@@ -163,46 +321,117 @@ void add_client(int connfd, pool *p) {
         app_error("add_client error: Too many clients");
 }
 
+/*
+ * check_clients - read whatever each ready client has sent without
+ * blocking, and serve only the complete lines in it. A client that
+ * trickles a request byte by byte costs one recv per wakeup, and the
+ * READ timer armed at its first byte is what bounds it.
+ */
 void check_clients(pool *p) {
-    int i, connfd, n;
+    int i, connfd, n, len, served;
     char buf[MAXLINE];
-    rio_t rio;
+    char *line, *nl, *end;
 
     for (i=0;(i<=p->maxi) && (p->nready > 0);i++) {     //nready는 처리해야할 event 개수
         connfd = p->clientfd[i];
-        rio = p->clientrio[i];
 
-        //If the descriptor is ready, echo a text line from it
         if ((connfd > 0) && (FD_ISSET(connfd, &p->ready_set))) {    
             p->nready--;
-            if ((n = Rio_readlineb(&rio, buf, MAXLINE)) != 0) {
-                printf("Server received %d bytes on fd %d\n", n, connfd);
-                handle_client_request(connfd, buf);
-                // Rio_writen(connfd, buf, MAXLINE);
+            n = recv(connfd, p->inbuf[i] + p->incnt[i], MAXLINE - 1 - p->incnt[i], MSG_DONTWAIT);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+                continue;
+            //EOF or error: remove descriptor from pool
+            if (n <= 0) {
+                remove_client(p, i);
+                continue;
             }
-
-            //EOF detected, remove descriptor from pool
-            else {
-                Close(connfd);
-                FD_CLR(connfd, &p->read_set);
-                p->clientfd[i] = -1;
+            p->incnt[i] += n;
+
+            /* Serve every complete line; a full buffer without one is served as is, like rio_readlineb */
+            line = p->inbuf[i];
+            end = line + p->incnt[i];
+            served = 0;
+            while ((nl = memchr(line, '\n', end - line)) != NULL ||
+                   (line == p->inbuf[i] && end - line == MAXLINE - 1)) {
+                len = (nl != NULL) ? nl + 1 - line : end - line;
+                memcpy(buf, line, len);
+                buf[len] = '\0';
+                line += len;
+                served = 1;
+                printf("Server received %d bytes on fd %d\n", len, connfd);
+                if (!bucket_take(&p->bucket[i], CONN_RATE, CONN_BURST) || !addr_take(p->addr_slot[i])) {
+                    strcpy(buf, RATE_MSG);
+                    send_reply(connfd, buf);
+                    continue;
+                }
+                handle_client_request(connfd, buf);
+                if (p->clientfd[i] < 0)
+                    break;
             }
+            if (p->clientfd[i] < 0)
+                continue;
+            p->incnt[i] = end - line;
+            memmove(p->inbuf[i], line, p->incnt[i]);
+
+            if (draining && p->incnt[i] == 0)
+                remove_client(p, i);    //Its last request has been answered
+            else if (served || p->incnt[i] == n)
+                arm_timer(p, i);        //Idle again, or a new request started
         }
     }
 }
 
-// void remove_client(int fd)
-// {
-//     for (int i = 0; i < p->maxi; i++) {
-//         if (p->clientfd[i] == fd) {
-//             p->clientfd[i] = p->clientfd[p->maxi - 1];
-//             p->maxi--;
-//             FD_CLR(fd, &p->read_set);
-//             Close(fd);
-//             break;
-//         }
-//     }
-// }
+void remove_client(pool *p, int i) {
+    Close(p->clientfd[i]);
+    FD_CLR(p->clientfd[i], &p->read_set);
+    p->clientfd[i] = -1;
+    tw_del(&wheel, &p->timer[i]);
+    conn_release();
+}
+
+/* arm_timer - idle timeout, or the shorter read timeout if a request is half received */
+void arm_timer(pool *p, int i) {
+    if (p->incnt[i] > 0) {
+        p->timer[i].kind = TIMEOUT_READ;
+        tw_add(&wheel, &p->timer[i], READ_TIMEOUT_MS);
+    } else {
+        p->timer[i].kind = TIMEOUT_IDLE;
+        tw_add(&wheel, &p->timer[i], IDLE_TIMEOUT_MS);
+    }
+}
+
+void client_timeout(tw_timer *t) {
+    pool *p = t->data;
+    printf("fd %d %s timeout\n", p->clientfd[t->arg], (t->kind == TIMEOUT_READ) ? "read" : "idle");
+    remove_client(p, t->arg);
+}
+
+/*
+ * set_socket_timeouts - replies are still blocking writes, so a peer that
+ * stops reading must not hold the loop forever. Accepted sockets inherit
+ * this option from the listening socket, which costs no syscall per
+ * connection. Reads never block (see check_clients).
+ */
+void set_socket_timeouts(int listenfd) {
+    struct timeval tv;
+
+    tv.tv_sec = WRITE_TIMEOUT_MS / 1000;
+    tv.tv_usec = (WRITE_TIMEOUT_MS % 1000) * 1000;
+    Setsockopt(listenfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/* send_reply - a failed write (peer gone or timed out) ends the connection, not the server */
+void send_reply(int fd, char *buf) {
+    if (rio_writen(fd, buf, MAXLINE) < 0)
+        shutdown(fd, SHUT_RDWR);
+}
+
+void reject(int connfd, char *msg) {
+    char buf[MAXLINE] = "";
+    strcpy(buf, msg);
+    rio_writen(connfd, buf, MAXLINE);       //Client may be gone already
+    Close(connfd);
+}
 
 //기존 echoServer에서 Rio_writen 함수 자리를 대체
 //buf를 받아와서 그에 맞는 함수를 호출
@@ -217,6 +446,8 @@ void handle_client_request(int fd, char* buf)
     //명령어 분해 후, 명령어에 맞는 함수 호출
     if (strcmp(token, "show\n") == 0) {
         handle_show_request(fd);
+    } else if (strcmp(token, "show") == 0) {
+        handle_show_query(fd, token + strlen(token) + 1);
     } else if (strcmp(token, "buy") == 0) {
         token = strtok(NULL, " ");
         if (token == NULL) {
@@ -249,15 +480,84 @@ void handle_client_request(int fd, char* buf)
 
 void handle_show_request(int fd)
 {
-    char temp[MAXLINE];
     char buf[MAXLINE] = "show\n";
-    int k = 5;              //앞에다가 show\n 적고나서 다음 문자열은 index6부터 입력
+    int len = 5;            //앞에다가 show\n 적고나서 다음 문자열은 index6부터 입력
     for (int i = 1; i <= num_stocks; i++) {
-        stock_item *item = stocks[i];
-        sprintf(temp, "%d %d %d\n", item->id, item->left_stock, item->price);
-        strcat(buf, temp);
+        if (!append_item(stocks[i], buf, &len))
+            break;
+    }
+    send_reply(fd, buf);
+}
+
+/*
+ * handle_show_query - show <lo> <hi>
+ *                     show top <N> by volume
+ *                     show where left_stock < <X>
+ */
+void handle_show_query(int fd, char *args)
+{
+    char buf[MAXLINE] = "show\n";
+    int len = 5, lo, hi, x, end = 0;
+
+    if (sscanf(args, "top %d by volume%n", &x, &end) == 1 && end > 0) {
+        show_index(IDX_VOLUME, x, INT_MAX, buf, &len);
+    } else if (sscanf(args, "where left_stock < %d%n", &x, &end) == 1 && end > 0) {
+        show_index(IDX_LEFT, MAXLINE, x, buf, &len);
+    } else if (sscanf(args, "%d %d", &lo, &hi) == 2) {
+        show_range(root, lo, hi, buf, &len);
+    } else {
+        strcat(buf, "usage: show [<lo> <hi> | top <N> by volume | where left_stock < <X>]\n");
     }
-    Rio_writen(fd, buf, MAXLINE);
+    send_reply(fd, buf);
+}
+
+/* show_range - in-order walk of the id tree, pruned to [lo, hi]. 0 once the reply is full */
+int show_range(stock_item *node, int lo, int hi, char *buf, int *len)
+{
+    if (node == NULL)
+        return 1;
+    if (lo < node->id && !show_range(node->left, lo, hi, buf, len))
+        return 0;
+    if (lo <= node->id && node->id <= hi && !append_item(node, buf, len))
+        return 0;
+    if (node->id < hi)
+        return show_range(node->right, lo, hi, buf, len);
+    return 1;
+}
+
+/* show_entries - in-order walk of a secondary index, like show_range; 0 once done */
+static int show_entries(index_entry *e, int *limit, int bound, char *buf, int *len)
+{
+    if (e == NULL)
+        return 1;
+    if (!show_entries(e->left, limit, bound, buf, len))
+        return 0;
+    if (*limit <= 0 || e->key >= bound || !append_item(e->item, buf, len))
+        return 0;
+    (*limit)--;
+    return show_entries(e->right, limit, bound, buf, len);
+}
+
+/* show_index - append up to limit items from the front of a secondary index whose key is below bound */
+void show_index(int which, int limit, int bound, char *buf, int *len)
+{
+    show_entries(indexes[which].root, &limit, bound, buf, len);
+}
+
+/* append_item - add "id left_stock price" to a reply, 0 once the reply is full */
+int append_item(stock_item *item, char *buf, int *len)
+{
+    char temp[MAXLINE];
+    int n = sprintf(temp, "%d %d %d\n", item->id, item->left_stock, item->price);
+
+    if (*len + n + (int)strlen(REPLY_MORE) >= MAXLINE) {
+        strcpy(buf + *len, REPLY_MORE);
+        *len += strlen(REPLY_MORE);
+        return 0;
+    }
+    strcpy(buf + *len, temp);
+    *len += n;
+    return 1;
 }
 
 void handle_buy_request(int connfd, int id, int num) {
@@ -268,6 +568,9 @@ void handle_buy_request(int connfd, int id, int num) {
     if(item != NULL) {
         if (item->left_stock >= num) {
             item->left_stock -= num;
+            item->volume += num;
+            reindex(item);
+            feed_publish(FEED_BUY, id, num, item->left_stock, item->price);
             sprintf(temp, "[buy] success\n");
             strcat(buf, temp);
         } else {
@@ -278,7 +581,7 @@ void handle_buy_request(int connfd, int id, int num) {
         sprintf(temp, "there is no such id\n");
         strcat(buf, temp);
     }
-    Rio_writen(connfd, buf, MAXLINE);
+    send_reply(connfd, buf);
 }
 
 void handle_sell_request(int connfd, int id, int num) {
@@ -289,13 +592,16 @@ void handle_sell_request(int connfd, int id, int num) {
     stock_item *item = findStockById(id);
     if(item != NULL) {
         item->left_stock += num;
+        item->volume += num;
+        reindex(item);
+        feed_publish(FEED_SELL, id, num, item->left_stock, item->price);
         sprintf(temp, "[sell] success\n");
         strcat(buf, temp);
     } else {
             sprintf(temp, "there is no such id\n");
             strcat(buf, temp);
     }
-    Rio_writen(connfd, buf, MAXLINE);
+    send_reply(connfd, buf);
 }
 
 void update_stock_file(char *filename)
@@ -314,20 +620,39 @@ void update_stock_file(char *filename)
     fclose(fp);
 }
 
-// Function to insert a new item into the binary tree
-stock_item* insertItem(stock_item* node, stock_item* item) {
-    if (node == NULL) {
-        return item;
-    }
+static int item_cmp_id(const void *a, const void *b) {
+    int x = (*(stock_item **)a)->id, y = (*(stock_item **)b)->id;
 
-    if (item->id < (node)->id) {
-        node->left = insertItem((node)->left, item);
-    } else if (item->id > (node)->id) {
-        node->right = insertItem((node)->right, item);
-    } else {
-        // Duplicate ID, handle accordingly (e.g., error or update existing item)
-    }
-    return node;
+    return (x > y) - (x < y);
+}
+
+static stock_item *build_range(stock_item **sorted, int n) {
+    int mid = n / 2;
+
+    if (n == 0)
+        return NULL;
+    sorted[mid]->left = build_range(sorted, mid);
+    sorted[mid]->right = build_range(sorted + mid + 1, n - mid - 1);
+    return sorted[mid];
+}
+
+/*
+ * build_tree - the id tree over items, balanced. stock.txt is usually
+ * in id order, and inserting in that order would make the tree a list:
+ * quadratic to load and as deep as there are stocks. items keeps its order.
+ */
+stock_item* build_tree(stock_item **items, int n) {
+    stock_item **sorted;
+    stock_item *top;
+
+    if (n == 0)
+        return NULL;
+    sorted = Malloc(n * sizeof(stock_item *));
+    memcpy(sorted, items, n * sizeof(stock_item *));
+    qsort(sorted, n, sizeof(stock_item *), item_cmp_id);
+    top = build_range(sorted, n);
+    free(sorted);
+    return top;
 }
 
 stock_item* findStockById(int id) {
@@ -340,3 +665,96 @@ stock_item* findStockById(int id) {
         else node = node->right;
     }
 }
+
+static int entry_before(int desc, index_entry *a, index_entry *b) {
+    if (a->key != b->key)
+        return desc ? (a->key > b->key) : (a->key < b->key);
+    return a->item->id < b->item->id;
+}
+
+// entry_insert - add e to the treap t, rotating it up past lower priorities
+static index_entry *entry_insert(int desc, index_entry *t, index_entry *e) {
+    index_entry *c;
+
+    if (t == NULL) {
+        e->left = e->right = NULL;
+        return e;
+    }
+    if (entry_before(desc, e, t)) {
+        c = t->left = entry_insert(desc, t->left, e);
+        if (c->prio > t->prio) {
+            t->left = c->right;
+            c->right = t;
+            return c;
+        }
+    } else {
+        c = t->right = entry_insert(desc, t->right, e);
+        if (c->prio > t->prio) {
+            t->right = c->left;
+            c->left = t;
+            return c;
+        }
+    }
+    return t;
+}
+
+// entry_join - one treap from a and b, every entry of a before those of b
+static index_entry *entry_join(index_entry *a, index_entry *b) {
+    if (a == NULL)
+        return b;
+    if (b == NULL)
+        return a;
+    if (a->prio > b->prio) {
+        a->right = entry_join(a->right, b);
+        return a;
+    }
+    b->left = entry_join(a, b->left);
+    return b;
+}
+
+// entry_remove - take e, found by its current key, out of the treap t
+static index_entry *entry_remove(int desc, index_entry *t, index_entry *e) {
+    if (t == e)
+        return entry_join(e->left, e->right);
+    if (entry_before(desc, e, t))
+        t->left = entry_remove(desc, t->left, e);
+    else
+        t->right = entry_remove(desc, t->right, e);
+    return t;
+}
+
+// Build a secondary index over stocks[] once the file is loaded
+void build_index(int which, int desc) {
+    stock_index *idx = &indexes[which];
+    int i;
+
+    idx->entries = Calloc(num_stocks, sizeof(index_entry));
+    idx->root = NULL;
+    idx->desc = desc;
+
+    for (i = 0; i < num_stocks; i++) {
+        stock_item *item = stocks[i + 1];
+        index_entry *e = &idx->entries[i];
+
+        e->key = (which == IDX_VOLUME) ? item->volume : item->left_stock;
+        e->prio = rand();
+        e->item = item;
+        item->entry[which] = e;
+        idx->root = entry_insert(desc, idx->root, e);
+    }
+}
+
+// Move item to its new place after its key changed, O(log n) expected
+void update_index(int which, stock_item *item, int key) {
+    stock_index *idx = &indexes[which];
+    index_entry *e = item->entry[which];
+
+    idx->root = entry_remove(idx->desc, idx->root, e);
+    e->key = key;
+    idx->root = entry_insert(idx->desc, idx->root, e);
+}
+
+void reindex(stock_item *item) {
+    update_index(IDX_VOLUME, item, item->volume);
+    update_index(IDX_LEFT, item, item->left_stock);
+}
@@ -0,0 +1,153 @@
+/*
+ * timer.c - hierarchical timing wheel
+ *
+ * A timer due in d ticks sits in level L, the first with d < 64^(L+1),
+ * at slot (expires >> 6L) & 63. Every 64 ticks one slot of the next
+ * level is emptied and its timers are re-linked closer to the cursor.
+ */
+#include <stddef.h>
+#include "timer.h"
+
+static void tw_link(tw_wheel *w, tw_timer *t);
+static void tw_unlink(tw_timer *t);
+static void tw_cascade(tw_wheel *w, int level);
+
+void tw_init(tw_wheel *w, unsigned long now_ms)
+{
+    int level, i;
+
+    w->now = now_ms / TW_TICK_MS;
+    w->pending = 0;
+    for (level = 0; level < TW_LEVELS; level++) {
+        for (i = 0; i < TW_SIZE; i++)
+            w->slots[level][i].next = w->slots[level][i].prev = &w->slots[level][i];
+    }
+}
+
+/* tw_add - arm t to fire after timeout_ms, re-arming it if already armed */
+void tw_add(tw_wheel *w, tw_timer *t, unsigned long timeout_ms)
+{
+    if (t->prev != NULL)
+        tw_unlink(t);
+    else
+        w->pending++;
+    t->expires = w->now + (timeout_ms + TW_TICK_MS - 1) / TW_TICK_MS;
+    tw_link(w, t);
+}
+
+void tw_del(tw_wheel *w, tw_timer *t)
+{
+    if (t->prev != NULL) {
+        tw_unlink(t);
+        w->pending--;
+    }
+}
+
+/* tw_advance - run every tick up to now_ms, firing the timers due */
+void tw_advance(tw_wheel *w, unsigned long now_ms)
+{
+    unsigned long target = now_ms / TW_TICK_MS;
+    tw_timer list, *t;
+
+    if (w->pending == 0) {
+        if (w->now <= target)
+            w->now = target + 1;
+        return;
+    }
+
+    while (w->now <= target) {
+        if ((w->now & TW_MASK) == 0)
+            tw_cascade(w, 1);
+
+        /* Detach the slot first so callbacks may re-arm freely */
+        t = &w->slots[0][w->now & TW_MASK];
+        if (t->next == t) {
+            w->now++;
+            continue;
+        }
+        list.next = t->next;
+        list.prev = t->prev;
+        list.next->prev = list.prev->next = &list;
+        t->next = t->prev = t;
+
+        w->now++;
+        while (list.next != &list) {
+            t = list.next;
+            tw_unlink(t);
+            w->pending--;
+            t->expire(t);
+        }
+    }
+}
+
+/* tw_timeout - ms until the next tick needs running, -1 if nothing is armed */
+long tw_timeout(tw_wheel *w, unsigned long now_ms)
+{
+    unsigned long next = w->now * TW_TICK_MS;
+
+    if (w->pending == 0)
+        return -1;
+    return (next > now_ms) ? (long)(next - now_ms) : 0;
+}
+
+/* tw_foreach - visit every armed timer; fn must not touch the wheel */
+void tw_foreach(tw_wheel *w, void (*fn)(tw_timer *t))
+{
+    tw_timer *head, *t;
+    int level, i;
+
+    for (level = 0; level < TW_LEVELS; level++) {
+        for (i = 0; i < TW_SIZE; i++) {
+            head = &w->slots[level][i];
+            for (t = head->next; t != head; t = t->next)
+                fn(t);
+        }
+    }
+}
+
+static void tw_link(tw_wheel *w, tw_timer *t)
+{
+    unsigned long delta = t->expires - w->now;
+    tw_timer *head;
+    int level;
+
+    if ((long)delta < 0) {              //Overdue: run on the next tick
+        t->expires = w->now;
+        delta = 0;
+    }
+    for (level = 0; level < TW_LEVELS - 1; level++) {
+        if (delta < (1UL << (TW_BITS * (level + 1))))
+            break;
+    }
+    if (delta >= (1UL << (TW_BITS * TW_LEVELS))) //Clamp to the wheel's range
+        t->expires = w->now + (1UL << (TW_BITS * TW_LEVELS)) - 1;
+
+    head = &w->slots[level][(t->expires >> (TW_BITS * level)) & TW_MASK];
+    t->next = head;
+    t->prev = head->prev;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+static void tw_unlink(tw_timer *t)
+{
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->next = t->prev = NULL;
+}
+
+/* tw_cascade - re-link the slot of this level that the cursor just reached */
+static void tw_cascade(tw_wheel *w, int level)
+{
+    int idx = (w->now >> (TW_BITS * level)) & TW_MASK;
+    tw_timer *head = &w->slots[level][idx], *t;
+
+    if (idx == 0 && level + 1 < TW_LEVELS)
+        tw_cascade(w, level + 1);
+
+    while (head->next != head) {
+        t = head->next;
+        tw_unlink(t);
+        tw_link(w, t);
+    }
+}
@@ -0,0 +1,40 @@
+/*
+ * timer.h - hierarchical timing wheel for connection timeouts
+ *
+ * Timers are embedded in the caller's per-connection state, so arming,
+ * re-arming and cancelling never allocate: each is an O(1) list splice.
+ * Far timers live in coarser levels and cascade down as time advances.
+ */
+#ifndef __TIMER_H__
+#define __TIMER_H__
+
+#define TW_BITS     6
+#define TW_SIZE     (1 << TW_BITS)      /* Slots per level */
+#define TW_MASK     (TW_SIZE - 1)
+#define TW_LEVELS   4                   /* 64^4 ticks, about 19 days */
+#define TW_TICK_MS  100                 /* Resolution of every timeout */
+
+typedef struct tw_timer {
+    struct tw_timer *next;
+    struct tw_timer *prev;              /* NULL while not armed */
+    unsigned long expires;              /* Absolute tick */
+    void (*expire)(struct tw_timer *t); /* Called once the timer fires */
+    void *data;
+    long arg;
+    int kind;
+} tw_timer;
+
+typedef struct {
+    unsigned long now;                  /* Next tick to run */
+    unsigned long pending;              /* Armed timers */
+    tw_timer slots[TW_LEVELS][TW_SIZE]; /* List heads */
+} tw_wheel;
+
+void tw_init(tw_wheel *w, unsigned long now_ms);
+void tw_add(tw_wheel *w, tw_timer *t, unsigned long timeout_ms);
+void tw_del(tw_wheel *w, tw_timer *t);
+void tw_advance(tw_wheel *w, unsigned long now_ms);
+long tw_timeout(tw_wheel *w, unsigned long now_ms);
+void tw_foreach(tw_wheel *w, void (*fn)(tw_timer *t));
+
+#endif /* __TIMER_H__ */
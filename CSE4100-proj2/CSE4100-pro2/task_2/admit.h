@@ -0,0 +1,32 @@
+/*
+ * admit.h - per-client rate limiting and admission control
+ *
+ * Every limit is a single word updated with atomic operations, so the
+ * checks can sit on the accept and request paths without taking a lock.
+ */
+#ifndef __ADMIT_H__
+#define __ADMIT_H__
+
+#include <sys/socket.h>
+
+#define CONN_RATE   100     /* Requests per second per connection */
+#define CONN_BURST  20      /* Requests a connection may send back to back */
+#define ADDR_RATE   1000    /* Requests per second per source address */
+#define ADDR_BURST  200
+#define ADDR_SLOTS  4096    /* Hashed per-address buckets, a power of 2 */
+
+/*
+ * Token bucket in GCRA form: the word holds the theoretical arrival
+ * time (usec) of the next request. Zero is a full bucket.
+ */
+typedef unsigned long bucket_t;
+
+unsigned long now_usec(void);
+int bucket_take(bucket_t *b, long rate, long burst);
+int addr_slot(struct sockaddr_storage *addr);
+int addr_take(int slot);
+int conn_admit(int max_conns);
+void conn_release(void);
+int conn_active(void);
+
+#endif /* __ADMIT_H__ */
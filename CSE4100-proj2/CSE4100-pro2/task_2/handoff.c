@@ -0,0 +1,126 @@
+/*
+ * handoff.c - listening socket handoff over a Unix socket (SCM_RIGHTS)
+ */
+#include <sys/un.h>
+#include "csapp.h"
+#include "handoff.h"
+
+static void handoff_addr(struct sockaddr_un *addr, char *port)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    snprintf(addr->sun_path, sizeof(addr->sun_path), HANDOFF_PATH, port);
+}
+
+/* handoff_listen - control socket a replacement server connects to */
+int handoff_listen(char *port)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    handoff_addr(&addr, port);
+    unlink(addr.sun_path);      //Left by the server we replaced, or a crashed one
+    fd = Socket(AF_UNIX, SOCK_STREAM, 0);
+    Bind(fd, (SA *)&addr, sizeof(addr));
+    Listen(fd, 1);
+    return fd;
+}
+
+/* handoff_unlink - on a plain shutdown; after a handoff the path is the successor's */
+void handoff_unlink(char *port)
+{
+    struct sockaddr_un addr;
+
+    handoff_addr(&addr, port);
+    unlink(addr.sun_path);
+}
+
+/* handoff_connect - reach the running server, -1 if there is none */
+int handoff_connect(char *port)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    handoff_addr(&addr, port);
+    fd = Socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connect(fd, (SA *)&addr, sizeof(addr)) < 0) {
+        Close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* handoff_send - pass n descriptors, -1 if the successor went away */
+int handoff_send(int connfd, int *fds, int n)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char ctl[CMSG_SPACE(HANDOFF_MAXFDS * sizeof(int))];
+    char byte = 'h';
+
+    memset(&msg, 0, sizeof(msg));
+    memset(ctl, 0, sizeof(ctl));
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl;
+    msg.msg_controllen = CMSG_SPACE(n * sizeof(int));
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(n * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, n * sizeof(int));
+
+    return (sendmsg(connfd, &msg, MSG_NOSIGNAL) < 0) ? -1 : 0;
+}
+
+/* handoff_recv - receive up to n descriptors, returns how many arrived */
+int handoff_recv(int connfd, int *fds, int n)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char ctl[CMSG_SPACE(HANDOFF_MAXFDS * sizeof(int))];
+    char byte;
+    int got;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl;
+    msg.msg_controllen = sizeof(ctl);
+
+    if (recvmsg(connfd, &msg, 0) <= 0)
+        return 0;
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        return 0;
+    got = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    if (got > n)
+        got = n;
+    memcpy(fds, CMSG_DATA(cmsg), got * sizeof(int));
+    return got;
+}
+
+/* handoff_done - tell the successor our state is on disk */
+void handoff_done(int connfd)
+{
+    char byte = 'd';
+
+    rio_writen(connfd, &byte, 1);
+    Close(connfd);
+}
+
+/* handoff_wait - block until the old server has drained (or died) */
+void handoff_wait(int connfd)
+{
+    char byte;
+
+    rio_readn(connfd, &byte, 1);
+    Close(connfd);
+}
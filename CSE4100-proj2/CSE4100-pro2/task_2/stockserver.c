@@ -2,26 +2,71 @@
  * stockserver_thread.c - A thread-based concurrent server
  */ 
 
+#include <limits.h>
+#include <sys/signalfd.h>
 #include "csapp.h"
+#include "feed.h"
+#include "admit.h"
+#include "timer.h"
+#include "handoff.h"
 
 #define MAX_STOCKS 100000
 #define FILENAME "stock.txt"
 #define SBUFSIZE 1000
 #define NTHREADS 1000
+#define MAX_CONNS (NTHREADS + SBUFSIZE / 2)    //Open connections, queued or served
+#define SHED_DEPTH (SBUFSIZE / 4)               //Shed new connections past this queue depth
+#define SHED_WAIT_USEC 200000                   //or past this average queue wait
+#define BUSY_MSG "server busy\n"
+#define RATE_MSG "rate limited\n"
+#define TIMEOUT_IDLE 0          //No request in progress
+#define TIMEOUT_READ 1          //Part of the next request is already buffered
+#define TIMEOUT_WRITE 2         //Handling and sending one reply
+#define IDLE_TIMEOUT_MS 60000
+#define READ_TIMEOUT_MS 5000
+#define WRITE_TIMEOUT_MS 5000
+#define DRAIN_TIMEOUT_MS 10000  //Longest a shutdown waits for in-flight requests
+#define IDX_VOLUME 0        //Secondary index by traded volume, descending
+#define IDX_LEFT 1          //Secondary index by left_stock, ascending
+#define NUM_INDEXES 2
+#define REPLY_MORE "...\n"  //Ends a reply that did not fit in MAXLINE
 
 typedef struct stock_item {
     int fd;
     int id;
     int left_stock;
     int price;
+    int volume;                 //Shares bought and sold so far
+    struct index_entry *entry[NUM_INDEXES];   //Node in each secondary index
     int readcnt;
     sem_t mutex, w;
     struct stock_item *left;
     struct stock_item *right;
 } stock_item;
 
+typedef struct index_entry {
+    int key;                //Copy of the indexed field, only changed under mutex
+    int prio;               //Random heap priority that keeps the treap balanced
+    stock_item *item;
+    struct index_entry *left;
+    struct index_entry *right;
+} index_entry;
+
+typedef struct {            //Treap of items by one field, ties broken by id
+    index_entry *entries;
+    index_entry *root;
+    int desc;
+    sem_t mutex;
+} stock_index;
+
 typedef struct {
-    int *buf;           //buffer array
+    int connfd;
+    int addr_slot;              //Per-address bucket of the peer
+    unsigned long enqueued;     //usec, to measure queue wait
+} conn_t;
+
+typedef struct {
+    conn_t *buf;        //buffer array
     int n;              //Maximum number of slots
     int front;          //buf[(front_1)%n] is first item
     int rear;           //buf[rear%n] is last item
@@ -34,27 +79,42 @@ typedef struct {
     int connfd;
 } thread_args;
  
-void sigint_handler(int signum);
-
 void sbuf_init(sbuf_t *sp, int n);
 void sbuf_deinit(sbuf_t *sp);
-void sbuf_insert(sbuf_t *sp, int item);
-int sbuf_remove(sbuf_t *sp);
+void sbuf_insert(sbuf_t *sp, conn_t item);
+conn_t sbuf_remove(sbuf_t *sp);
 void *thread(void *vargp);
+void *timer_thread(void *vargp);
+void arm_timer(tw_timer *t, int kind);
+void conn_timeout(tw_timer *t);
+void drain_timeout(tw_timer *t);
+void drain_connections(void);
+int overloaded(sbuf_t *sp);
+void reject(int connfd, char *msg);
 
 void get_stock_from_file();
-void handle_client_request(int connfd);
+void handle_client_request(int connfd, int addr_slot);
+void handle_request(int connfd, char *buf);
+void send_reply(int connfd, char *buf);
 void remove_client(int connfd);
 void handle_show_request(int connfd);
+void handle_show_query(int connfd, char *args);
+int show_range(stock_item *node, int lo, int hi, char *buf, int *len);
+void show_index(int which, int limit, int bound, char *buf, int *len);
+int append_item(stock_item *item, char *buf, int *len);
 void handle_buy_request(int connfd, int id, int num);
 void handle_sell_request(int connfd, int id, int num);
 void update_stock_file(const char *filename);
-stock_item* insertItem(stock_item* node, stock_item* item);
+stock_item* build_tree(stock_item **items, int n);
 stock_item* findStockById(int id);
+void build_index(int which, int desc);
+void update_index(int which, stock_item *item, int key);
+void reindex(stock_item *item);
 
 int byte_cnt = 0;
 sbuf_t sbuf;
 int request_cnt = 0;
+unsigned long queue_wait = 0;   //Moving average of sbuf wait (usec)
 struct timeval start;	/* starting time */
 struct timeval end;	/* ending time */
 unsigned long e_usec;	/* elapsed microseconds */
@@ -63,46 +123,143 @@ stock_item* root = NULL;
 struct stock_item* stocks[MAX_STOCKS];
 
 int num_stocks = 0;
+stock_index indexes[NUM_INDEXES];
+
+tw_wheel wheel;             //Timeouts of every open connection
+sem_t wheel_mutex;
+const char *timeout_names[] = {"idle", "read", "write"};
+int draining = 0;           //Set once, when shutdown or handoff starts
 
 int main(int argc, char **argv) 
 {
-    int i, listenfd, connfd;
+    int i, n, listenfd, connfd, ctlfd, sigfd, succfd = -1, maxfd;
+    int fds[HANDOFF_MAXFDS];
+    conn_t conn;
     socklen_t clientlen;
     struct sockaddr_storage clientaddr;
+    struct signalfd_siginfo si;
+    sigset_t mask;
+    fd_set ready_set;
     pthread_t tid;
     
-    if (argc != 2) {
-        fprintf(stderr, "usage: %s <port>\n", argv[0]);
+    if (argc != 2 && !(argc == 3 && !strcmp(argv[2], "-takeover"))) {
+        fprintf(stderr, "usage: %s <port> [-takeover]\n", argv[0]);
+        fprintf(stderr, "market data: udp %s:<port>+%d, recovery tcp <port>+%d\n",
+                FEED_GROUP, FEED_UDP_OFFSET, FEED_TCP_OFFSET);
         exit(0);
     }
 
-    listenfd = Open_listenfd(argv[1]);
+    /* -takeover: inherit the listening socket and feed of the running server */
+    n = 0;
+    if (argc == 3) {
+        if ((ctlfd = handoff_connect(argv[1])) < 0)
+            app_error("no running server to take over");
+        if ((n = handoff_recv(ctlfd, fds, HANDOFF_MAXFDS)) == 0)
+            app_error("handoff refused");
+        listenfd = fds[0];
+        handoff_wait(ctlfd);    //Its stock file is complete after this
+    } else {
+        listenfd = Open_listenfd(argv[1]);
+    }
     sbuf_init(&sbuf, SBUFSIZE);
 
-    Signal(SIGINT, sigint_handler);
+    Signal(SIGPIPE, SIG_IGN);       //A vanished client fails its write instead
     get_stock_from_file();
-
+    if (n == HANDOFF_MAXFDS)
+        feed_adopt(fds[1]);
+    else
+        feed_start(atoi(argv[1]) + FEED_UDP_OFFSET, atoi(argv[1]) + FEED_TCP_OFFSET);
+
+    /* SIGINT/SIGTERM are read from a signalfd below; block them before any thread exists */
+    Sigemptyset(&mask);
+    Sigaddset(&mask, SIGINT);
+    Sigaddset(&mask, SIGTERM);
+    Sigprocmask(SIG_BLOCK, &mask, NULL);
+    if ((sigfd = signalfd(-1, &mask, 0)) < 0)
+        unix_error("signalfd error");
+    ctlfd = handoff_listen(argv[1]);
+
+    tw_init(&wheel, now_usec() / 1000);
+    Sem_init(&wheel_mutex, 0, 1);
+    Pthread_create(&tid, NULL, timer_thread, NULL);
     for (i = 0; i < NTHREADS; i++) 
         Pthread_create(&tid, NULL, thread, NULL);
 
+    maxfd = listenfd;
+    if (sigfd > maxfd) maxfd = sigfd;
+    if (ctlfd > maxfd) maxfd = ctlfd;
     while (1) {
+        FD_ZERO(&ready_set);
+        FD_SET(listenfd, &ready_set);
+        FD_SET(sigfd, &ready_set);
+        FD_SET(ctlfd, &ready_set);
+        Select(maxfd + 1, &ready_set, NULL, NULL, NULL);
+
+        if (FD_ISSET(sigfd, &ready_set)) {
+            Read(sigfd, &si, sizeof(si));
+            printf("signal %d, shutting down\n", si.ssi_signo);
+            break;
+        }
+
+        /* A replacement server asks for our sockets; stop accepting once it has them */
+        if (FD_ISSET(ctlfd, &ready_set) && (succfd = accept(ctlfd, NULL, NULL)) >= 0) {
+            fds[0] = listenfd;
+            fds[1] = feed_pipe();
+            if (handoff_send(succfd, fds, (fds[1] >= 0) ? 2 : 1) == 0) {
+                printf("handing off to a new server\n");
+                break;
+            }
+            Close(succfd);
+            succfd = -1;
+        }
+
+        if (!FD_ISSET(listenfd, &ready_set))
+            continue;
         clientlen = sizeof(struct sockaddr_storage);
         connfd = Accept(listenfd, (SA *) &clientaddr, &clientlen);
-        sbuf_insert(&sbuf, connfd);   //connfd를 버퍼에 넣어줄 것임. connfd가 버퍼에 들어가 있다가 thread가 하나씩 꺼내감.
+
+        /* Turn clients away here rather than blocking on a full sbuf */
+        if (overloaded(&sbuf) || !conn_admit(MAX_CONNS)) {
+            reject(connfd, BUSY_MSG);
+            continue;
+        }
+        conn.connfd = connfd;
+        conn.addr_slot = addr_slot(&clientaddr);
+        sbuf_insert(&sbuf, conn);   //connfd를 버퍼에 넣어줄 것임. connfd가 버퍼에 들어가 있다가 thread가 하나씩 꺼내감.
     }
+
+    Close(listenfd);        //A successor holds its own copy
+    Close(ctlfd);
+    if (succfd < 0)
+        handoff_unlink(argv[1]);
+    drain_connections();
     update_stock_file(FILENAME);
+    if (succfd >= 0)
+        handoff_done(succfd);
     exit(0);
 }
 
+/*
+ * drain_connections - let every request already received get its reply,
+ * then return. Gives up after DRAIN_TIMEOUT_MS.
+ */
+void drain_connections(void)
+{
+    unsigned long deadline = now_usec() + DRAIN_TIMEOUT_MS * 1000UL;
 
-void sigint_handler(int signum){
-    update_stock_file(FILENAME);
-    if(root == NULL) printf("root is null\n");
-    exit(0);
+    __atomic_store_n(&draining, 1, __ATOMIC_RELAXED);
+    P(&wheel_mutex);
+    tw_foreach(&wheel, drain_timeout);
+    V(&wheel_mutex);
+
+    while (conn_active() > 0 && now_usec() < deadline)
+        usleep(TW_TICK_MS * 1000);
+    if (conn_active() > 0)
+        printf("%d connections still busy, exiting anyway\n", conn_active());
 }
 
 void sbuf_init(sbuf_t *sp, int n){
-    sp->buf = Calloc(n, sizeof(int));
+    sp->buf = Calloc(n, sizeof(conn_t));
     sp->n = n;
     sp->front = sp->rear = 0;
     Sem_init(&sp->mutex, 0, 1);
@@ -114,36 +271,95 @@ void sbuf_deinit(sbuf_t *sp) {
     Free(sp->buf);
 }
 
-void sbuf_insert(sbuf_t *sp, int item) {
+void sbuf_insert(sbuf_t *sp, conn_t item) {
     P(&sp->slots);                  //비어있는 슬롯이 없다면 slot이 생길 때까지 기다림(slot이 1 이상이 되는 순간 slot을 0으로 만들고 리턴)
     P(&sp->mutex);
     if(sp->rear == 0) 
         gettimeofday(&start, 0);        // 시간측정시작점
+    item.enqueued = now_usec();
     sp->buf[(++sp->rear)%(sp->n)] = item;
     V(&sp->mutex);
     V(&sp->items);                  //item을 1증가
 }
 
-int sbuf_remove(sbuf_t *sp) { 
-    int item;
+conn_t sbuf_remove(sbuf_t *sp) { 
+    conn_t item;
+    unsigned long wait;
     P(&sp->items);
     P(&sp->mutex);
     item = sp->buf[(++sp->front) % (sp->n)];
+    wait = now_usec() - item.enqueued;
+    __atomic_store_n(&queue_wait, queue_wait - queue_wait / 8 + wait / 8, __ATOMIC_RELAXED);
     V(&sp->mutex);
     V(&sp->slots);
     return item;
 }
 
+/*
+ * overloaded - read without the sbuf lock; a stale answer only delays shedding.
+ * queue_wait only moves when a connection is dequeued, so it is ignored once
+ * the queue is empty; otherwise a shed burst would leave it high forever.
+ */
+int overloaded(sbuf_t *sp) {
+    int depth = __atomic_load_n(&sp->rear, __ATOMIC_RELAXED) - __atomic_load_n(&sp->front, __ATOMIC_RELAXED);
+    return depth > SHED_DEPTH ||
+        (depth > 0 && __atomic_load_n(&queue_wait, __ATOMIC_RELAXED) > SHED_WAIT_USEC);
+}
+
+void reject(int connfd, char *msg) {
+    char buf[MAXLINE] = "";
+    strcpy(buf, msg);
+    rio_writen(connfd, buf, MAXLINE);       //Client may be gone already
+    Close(connfd);
+}
+
 void *thread(void *vargp) {
     Pthread_detach(pthread_self());
     while (1) {
-        int connfd = sbuf_remove(&sbuf);
-        handle_client_request(connfd);
-        Close(connfd);
+        conn_t conn = sbuf_remove(&sbuf);
+        handle_client_request(conn.connfd, conn.addr_slot);
+        Close(conn.connfd);
+        conn_release();
+    }
+    return NULL;
+}
+
+/* timer_thread - drives the wheel; it only has to wake once per tick */
+void *timer_thread(void *vargp) {
+    Pthread_detach(pthread_self());
+    while (1) {
+        usleep(TW_TICK_MS * 1000);
+        P(&wheel_mutex);
+        tw_advance(&wheel, now_usec() / 1000);
+        V(&wheel_mutex);
     }
     return NULL;
 }
 
+/* arm_timer - (re)arm a connection's timer for one of the TIMEOUT_ kinds */
+void arm_timer(tw_timer *t, int kind) {
+    static const unsigned long timeouts[] = {IDLE_TIMEOUT_MS, READ_TIMEOUT_MS, WRITE_TIMEOUT_MS};
+    P(&wheel_mutex);
+    t->kind = kind;
+    tw_add(&wheel, t, timeouts[kind]);
+    V(&wheel_mutex);
+}
+
+/*
+ * conn_timeout - runs under wheel_mutex, so the owning thread cannot
+ * close the fd underneath us. shutdown() wakes the blocked read or
+ * write, and the worker then closes the connection as on EOF.
+ */
+void conn_timeout(tw_timer *t) {
+    printf("connfd %ld %s timeout\n", t->arg, timeout_names[t->kind]);
+    shutdown(t->arg, SHUT_RDWR);
+}
+
+/* drain_timeout - wake a worker blocked in read, but leave room for its reply */
+void drain_timeout(tw_timer *t) {
+    shutdown(t->arg, SHUT_RD);
+}
+
 void get_stock_from_file(){
     FILE *fp = fopen(FILENAME, "r");
     if (fp == NULL) {
@@ -168,71 +384,122 @@ void get_stock_from_file(){
             continue;
         }
         int price = atoi(token);
+        if (num_stocks == MAX_STOCKS - 1) { /* stocks[] is 1-based */
+            fprintf(stderr, "%s: more than %d stocks, the rest are not loaded\n", FILENAME, MAX_STOCKS - 1);
+            break;
+        }
         stock_item *item = (struct stock_item*)malloc(sizeof(stock_item));
         item->id = id;
         item->left_stock = left_stock;
         item->price = price;
+        item->volume = 0;
         item->readcnt = 0;
         item->left = NULL;
         item->right = NULL;
         Sem_init(&(item->mutex), 0, 1);
         Sem_init(&(item->w), 0, 1);
         stocks[++num_stocks] = item;
-        root = insertItem(root, item);
+        feed_add_stock(id, left_stock, price);
     }
 
     fclose(fp);
+    root = build_tree(&stocks[1], num_stocks);
+    build_index(IDX_VOLUME, 1);
+    build_index(IDX_LEFT, 0);
 }
 
-void handle_client_request(int connfd)
+/*
+ * handle_client_request - serve one connection until EOF or a timeout.
+ * The timer lives on this stack, so it is disarmed before returning.
+ */
+void handle_client_request(int connfd, int addr_slot)
 {
-
     char buf[MAXLINE];
     int n;
     rio_t rio;
-
+    bucket_t conn_bucket = 0;
+    tw_timer timer;
+
+    memset(&timer, 0, sizeof(timer));
+    timer.expire = conn_timeout;
+    timer.arg = connfd;
+    arm_timer(&timer, TIMEOUT_IDLE);
+
+    /*
+     * The timer is armed before draining is checked, so a drain that
+     * starts after the check still finds it and wakes the read.
+     * While draining, serve what is buffered but read nothing new.
+     */
     Rio_readinitb(&rio, connfd);
-    while ((n = Rio_readlineb(&rio, buf, MAXLINE)) > 0) {
+    while (!(__atomic_load_n(&draining, __ATOMIC_RELAXED) && rio.rio_cnt == 0) &&
+           (n = rio_readlineb(&rio, buf, MAXLINE)) > 0) {
+        if (buf[n - 1] != '\n' && __atomic_load_n(&draining, __ATOMIC_RELAXED))
+            break;      //Cut short by the drain; the client retries on our successor
+        arm_timer(&timer, TIMEOUT_WRITE);
         request_cnt++;
         printf("Server received %d bytes on connfd %d\n", n, connfd);
-        char *token = strtok(buf, " ");
+        if (!bucket_take(&conn_bucket, CONN_RATE, CONN_BURST) || !addr_take(addr_slot)) {
+            strcpy(buf, RATE_MSG);
+            send_reply(connfd, buf);
+        } else {
+            handle_request(connfd, buf);
+        }
+        arm_timer(&timer, (rio.rio_cnt > 0) ? TIMEOUT_READ : TIMEOUT_IDLE);
+    }
+
+    P(&wheel_mutex);
+    tw_del(&wheel, &timer);
+    V(&wheel_mutex);
+}
+
+void handle_request(int connfd, char *buf)
+{
+    char *token = strtok(buf, " ");
+    if (token == NULL) {
+        return;
+    }
+
+    //명령어 분해 후, 명령어에 맞는 함수 호출
+    if (strcmp(token, "show\n") == 0) {
+        handle_show_request(connfd);
+    } else if (strcmp(token, "show") == 0) {
+        handle_show_query(connfd, token + strlen(token) + 1);
+    } else if (strcmp(token, "buy") == 0) {
+        token = strtok(NULL, " ");
         if (token == NULL) {
             return;
         }
-
-        //명령어 분해 후, 명령어에 맞는 함수 호출
-        if (strcmp(token, "show\n") == 0) {
-            handle_show_request(connfd);
-        } else if (strcmp(token, "buy") == 0) {
-            token = strtok(NULL, " ");
-            if (token == NULL) {
-                return;
-            }
-            int id = atoi(token);
-            token = strtok(NULL, " ");
-            if (token == NULL) {
-                return;
-            }
-            int num = atoi(token);
-            handle_buy_request(connfd, id, num);
-        } else if (strcmp(token, "sell") == 0) {
-            token = strtok(NULL, " ");
-            if (token == NULL) {
-                return;
-            }
-            int id = atoi(token);
-            token = strtok(NULL, " ");
-            if (token == NULL) {
-                return;
-            }
-            int num = atoi(token);
-            handle_sell_request(connfd, id, num);
-        } else if (strcmp(token, "exit\n") == 0) {
-            update_stock_file(FILENAME);
-        } else {
-            Rio_writen(connfd, "Unvalid command\n", MAXLINE);
+        int id = atoi(token);
+        token = strtok(NULL, " ");
+        if (token == NULL) {
+            return;
+        }
+        int num = atoi(token);
+        handle_buy_request(connfd, id, num);
+    } else if (strcmp(token, "sell") == 0) {
+        token = strtok(NULL, " ");
+        if (token == NULL) {
+            return;
+        }
+        int id = atoi(token);
+        token = strtok(NULL, " ");
+        if (token == NULL) {
+            return;
         }
-    }    
+        int num = atoi(token);
+        handle_sell_request(connfd, id, num);
+    } else if (strcmp(token, "exit\n") == 0) {
+        update_stock_file(FILENAME);
+    } else {
+        strcpy(buf, "Unvalid command\n");
+        send_reply(connfd, buf);
+    }
+}
+
+/* send_reply - a failed write (peer gone or timed out) ends the connection, not the server */
+void send_reply(int connfd, char *buf) {
+    if (rio_writen(connfd, buf, MAXLINE) < 0)
+        shutdown(connfd, SHUT_RDWR);
 }
 
 void remove_client(int connfd) {
@@ -242,27 +509,113 @@ void remove_client(int connfd) {
 void handle_show_request(int connfd) {
     int i;
     char buf[MAXLINE] = "show\n";
-    char temp[MAXLINE];
+    int len = 5;
 
-    for (int i = 1; i <= num_stocks; i++) {
-        stock_item *item = stocks[i];
-        P(&(item->mutex));
-        item->readcnt++;
-        if (item->readcnt == 1)
-            P(&(item->w));
-        V(&(item->mutex));
+    for (i = 1; i <= num_stocks; i++) {
+        if (!append_item(stocks[i], buf, &len))
+            break;
+    }
 
-        sprintf(temp, "%d %d %d\n", item->id, item->left_stock, item->price);
-        strcat(buf, temp);
+    send_reply(connfd, buf);
+}
 
-        P(&(item->mutex));
-        item->readcnt--;
-        if (item->readcnt == 0)
-            V(&(item->w));
-        V(&(item->mutex));
+/*
+ * handle_show_query - show <lo> <hi>
+ *                     show top <N> by volume
+ *                     show where left_stock < <X>
+ */
+void handle_show_query(int connfd, char *args) {
+    char buf[MAXLINE] = "show\n";
+    int len = 5, lo, hi, x, end = 0;
+
+    if (sscanf(args, "top %d by volume%n", &x, &end) == 1 && end > 0) {
+        show_index(IDX_VOLUME, x, INT_MAX, buf, &len);
+    } else if (sscanf(args, "where left_stock < %d%n", &x, &end) == 1 && end > 0) {
+        show_index(IDX_LEFT, MAXLINE, x, buf, &len);
+    } else if (sscanf(args, "%d %d", &lo, &hi) == 2) {
+        show_range(root, lo, hi, buf, &len);
+    } else {
+        strcat(buf, "usage: show [<lo> <hi> | top <N> by volume | where left_stock < <X>]\n");
     }
 
-    Rio_writen(connfd, buf, MAXLINE);
+    send_reply(connfd, buf);
+}
+
+/* show_range - in-order walk of the id tree, pruned to [lo, hi]. 0 once the reply is full */
+int show_range(stock_item *node, int lo, int hi, char *buf, int *len) {
+    if (node == NULL)
+        return 1;
+    if (lo < node->id && !show_range(node->left, lo, hi, buf, len))
+        return 0;
+    if (lo <= node->id && node->id <= hi && !append_item(node, buf, len))
+        return 0;
+    if (node->id < hi)
+        return show_range(node->right, lo, hi, buf, len);
+    return 1;
+}
+
+/* pick_entries - in-order walk of a secondary index, like show_range; 0 once done */
+static int pick_entries(index_entry *e, int limit, int bound, stock_item **picked, int *n) {
+    if (e == NULL)
+        return 1;
+    if (!pick_entries(e->left, limit, bound, picked, n))
+        return 0;
+    if (*n >= limit || e->key >= bound)
+        return 0;
+    picked[(*n)++] = e->item;
+    return pick_entries(e->right, limit, bound, picked, n);
+}
+
+/*
+ * show_index - append up to limit items from the front of a secondary
+ * index whose key is below bound. Items are picked under the index lock
+ * and formatted after it is released, so the lock order stays item -> index.
+ */
+void show_index(int which, int limit, int bound, char *buf, int *len) {
+    stock_index *idx = &indexes[which];
+    stock_item *picked[MAXLINE / 6];    //"1 0 0\n" is the shortest line
+    int i, n = 0;
+
+    if (limit > MAXLINE / 6)
+        limit = MAXLINE / 6;
+
+    P(&idx->mutex);
+    pick_entries(idx->root, limit, bound, picked, &n);
+    V(&idx->mutex);
+
+    for (i = 0; i < n; i++) {
+        if (!append_item(picked[i], buf, len))
+            break;
+    }
+}
+
+/* append_item - add "id left_stock price" to a reply, 0 once the reply is full */
+int append_item(stock_item *item, char *buf, int *len) {
+    char temp[MAXLINE];
+    int n;
+
+    P(&(item->mutex));
+    item->readcnt++;
+    if (item->readcnt == 1)
+        P(&(item->w));
+    V(&(item->mutex));
+
+    n = sprintf(temp, "%d %d %d\n", item->id, item->left_stock, item->price);
+
+    P(&(item->mutex));
+    item->readcnt--;
+    if (item->readcnt == 0)
+        V(&(item->w));
+    V(&(item->mutex));
+
+    if (*len + n + (int)strlen(REPLY_MORE) >= MAXLINE) {
+        strcpy(buf + *len, REPLY_MORE);
+        *len += strlen(REPLY_MORE);
+        return 0;
+    }
+    strcpy(buf + *len, temp);
+    *len += n;
+    return 1;
 }
 
 void handle_buy_request(int connfd, int id, int num) {
@@ -274,6 +627,9 @@ void handle_buy_request(int connfd, int id, int num) {
         P(&(item->w));
         if (item->left_stock >= num) {
             item->left_stock -= num;
+            item->volume += num;
+            reindex(item);
+            feed_publish(FEED_BUY, id, num, item->left_stock, item->price);
             sprintf(temp, "[buy] success\n");
             strcat(buf, temp);
         } else {
@@ -285,7 +641,7 @@ void handle_buy_request(int connfd, int id, int num) {
         sprintf(temp, "there is no such id\n");
         strcat(buf, temp);
     }
-    Rio_writen(connfd, buf, MAXLINE);
+    send_reply(connfd, buf);
 }
 
 void handle_sell_request(int connfd, int id, int num) {
@@ -297,6 +653,9 @@ void handle_sell_request(int connfd, int id, int num) {
     if(item != NULL) {
         P(&(item->w));
         item->left_stock += num;
+        item->volume += num;
+        reindex(item);
+        feed_publish(FEED_SELL, id, num, item->left_stock, item->price);
         sprintf(temp, "[sell] success\n");
         strcat(buf, temp);
         V(&(item->w));
@@ -304,7 +663,7 @@ void handle_sell_request(int connfd, int id, int num) {
             sprintf(temp, "there is no such id\n");
             strcat(buf, temp);
     }
-    Rio_writen(connfd, buf, MAXLINE);
+    send_reply(connfd, buf);
 }
 
 void update_stock_file(const char *filename) {
@@ -323,20 +682,39 @@ void update_stock_file(const char *filename) {
     fclose(fp);
 }
 
-// Function to insert a new item into the binary tree
-stock_item* insertItem(stock_item* node, stock_item* item) {
-    if (node == NULL) {
-        return item;
-    }
+static int item_cmp_id(const void *a, const void *b) {
+    int x = (*(stock_item **)a)->id, y = (*(stock_item **)b)->id;
 
-    if (item->id < (node)->id) {
-        node->left = insertItem((node)->left, item);
-    } else if (item->id > (node)->id) {
-        node->right = insertItem((node)->right, item);
-    } else {
-        // Duplicate ID, handle accordingly (e.g., error or update existing item)
-    }
-    return node;
+    return (x > y) - (x < y);
+}
+
+static stock_item *build_range(stock_item **sorted, int n) {
+    int mid = n / 2;
+
+    if (n == 0)
+        return NULL;
+    sorted[mid]->left = build_range(sorted, mid);
+    sorted[mid]->right = build_range(sorted + mid + 1, n - mid - 1);
+    return sorted[mid];
+}
+
+/*
+ * build_tree - the id tree over items, balanced. stock.txt is usually
+ * in id order, and inserting in that order would make the tree a list:
+ * quadratic to load and as deep as there are stocks. items keeps its order.
+ */
+stock_item* build_tree(stock_item **items, int n) {
+    stock_item **sorted;
+    stock_item *top;
+
+    if (n == 0)
+        return NULL;
+    sorted = Malloc(n * sizeof(stock_item *));
+    memcpy(sorted, items, n * sizeof(stock_item *));
+    qsort(sorted, n, sizeof(stock_item *), item_cmp_id);
+    top = build_range(sorted, n);
+    free(sorted);
+    return top;
 }
 
 stock_item* findStockById(int id) {
@@ -349,3 +727,100 @@ stock_item* findStockById(int id) {
         else node = node->right;
     }
 }
+
+static int entry_before(int desc, index_entry *a, index_entry *b) {
+    if (a->key != b->key)
+        return desc ? (a->key > b->key) : (a->key < b->key);
+    return a->item->id < b->item->id;
+}
+
+// entry_insert - add e to the treap t, rotating it up past lower priorities
+static index_entry *entry_insert(int desc, index_entry *t, index_entry *e) {
+    index_entry *c;
+
+    if (t == NULL) {
+        e->left = e->right = NULL;
+        return e;
+    }
+    if (entry_before(desc, e, t)) {
+        c = t->left = entry_insert(desc, t->left, e);
+        if (c->prio > t->prio) {
+            t->left = c->right;
+            c->right = t;
+            return c;
+        }
+    } else {
+        c = t->right = entry_insert(desc, t->right, e);
+        if (c->prio > t->prio) {
+            t->right = c->left;
+            c->left = t;
+            return c;
+        }
+    }
+    return t;
+}
+
+// entry_join - one treap from a and b, every entry of a before those of b
+static index_entry *entry_join(index_entry *a, index_entry *b) {
+    if (a == NULL)
+        return b;
+    if (b == NULL)
+        return a;
+    if (a->prio > b->prio) {
+        a->right = entry_join(a->right, b);
+        return a;
+    }
+    b->left = entry_join(a, b->left);
+    return b;
+}
+
+// entry_remove - take e, found by its current key, out of the treap t
+static index_entry *entry_remove(int desc, index_entry *t, index_entry *e) {
+    if (t == e)
+        return entry_join(e->left, e->right);
+    if (entry_before(desc, e, t))
+        t->left = entry_remove(desc, t->left, e);
+    else
+        t->right = entry_remove(desc, t->right, e);
+    return t;
+}
+
+// Build a secondary index over stocks[] once the file is loaded
+void build_index(int which, int desc) {
+    stock_index *idx = &indexes[which];
+    int i;
+
+    idx->entries = Calloc(num_stocks, sizeof(index_entry));
+    idx->root = NULL;
+    idx->desc = desc;
+    Sem_init(&idx->mutex, 0, 1);
+
+    for (i = 0; i < num_stocks; i++) {
+        stock_item *item = stocks[i + 1];
+        index_entry *e = &idx->entries[i];
+
+        e->key = (which == IDX_VOLUME) ? item->volume : item->left_stock;
+        e->prio = rand();
+        e->item = item;
+        item->entry[which] = e;
+        idx->root = entry_insert(desc, idx->root, e);
+    }
+}
+
+// Move item to its new place after its key changed, O(log n) expected
+void update_index(int which, stock_item *item, int key) {
+    stock_index *idx = &indexes[which];
+    index_entry *e = item->entry[which];
+
+    P(&idx->mutex);
+    idx->root = entry_remove(idx->desc, idx->root, e);
+    e->key = key;
+    idx->root = entry_insert(idx->desc, idx->root, e);
+    V(&idx->mutex);
+}
+
+// Caller holds item->w, which keeps updates of one item in order
+void reindex(stock_item *item) {
+    update_index(IDX_VOLUME, item, item->volume);
+    update_index(IDX_LEFT, item, item->left_stock);
+}
@@ -0,0 +1,196 @@
+/*
+ * mm-mtdriver.c - multithreaded trace driver for the MM_THREADS build
+ *
+ * Each thread runs a random malloc/free trace over its own slots. A
+ * share of the blocks is passed to the next thread through a mailbox
+ * and freed there, so remote frees are exercised as well. Payloads are
+ * filled and checked, so a block handed out twice shows up as an error.
+ *
+ * Build next to the lab's memlib.c and mm.h:
+ *   gcc -O2 -DMM_THREADS -pthread -o mtdriver mm-mtdriver.c mm.c memlib.c
+ * and for the lock-only baseline add -DTCACHE_MAX=0. With -DMM_STATS
+ * the allocator's report (mm_stats) is printed after the run.
+ *
+ * usage: mtdriver [-t threads] [-n ops per thread] [-r remote free %]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#ifdef MM_STATS
+void mm_stats(FILE *fp);
+#endif
+
+#define MAX_THREADS 64
+#define SLOTS 512          /* Live blocks per thread */
+#define MAILBOX 64         /* Blocks in flight to the next thread */
+#define SMALL_PCT 90       /* Share of requests of at most 128 bytes */
+
+typedef struct {
+    char *p;
+    int size;
+} slot_t;
+
+typedef struct {
+    pthread_t tid;
+    int id;
+    unsigned int seed;
+    long errors;
+    slot_t slots[SLOTS];
+    slot_t mailbox[MAILBOX]; /* Filled by the previous thread */
+    pthread_mutex_t lock;
+} worker_t;
+
+static worker_t workers[MAX_THREADS];
+static int nthreads = 4;
+static long nops = 1000000;
+static int remote_pct = 10;
+
+static int pick_size(unsigned int *seed)
+{
+    if (rand_r(seed) % 100 < SMALL_PCT)
+        return 1 + rand_r(seed) % 128;
+    return 129 + rand_r(seed) % 4096;
+}
+
+static void fill(slot_t *s, int id)
+{
+    memset(s->p, id & 0xff, s->size);
+}
+
+static long check(slot_t *s, int id)
+{
+    int i;
+
+    for (i = 0; i < s->size; i++)
+        if ((unsigned char)s->p[i] != (id & 0xff))
+            return 1;
+    return 0;
+}
+
+/* give - hand a block to the next thread; if its mailbox slot is taken, free that one */
+static void give(worker_t *w, slot_t *s)
+{
+    worker_t *next = &workers[(w->id + 1) % nthreads];
+    int k = rand_r(&w->seed) % MAILBOX;
+    slot_t old;
+
+    pthread_mutex_lock(&next->lock);
+    old = next->mailbox[k];
+    next->mailbox[k] = *s;
+    pthread_mutex_unlock(&next->lock);
+    if (old.p != NULL)
+        mm_free(old.p);     /* Allocated by us, freed by us; the slot was never read */
+}
+
+/* collect - free whatever the previous thread handed us */
+static void collect(worker_t *w)
+{
+    int k;
+    slot_t s;
+
+    for (k = 0; k < MAILBOX; k++) {
+        pthread_mutex_lock(&w->lock);
+        s = w->mailbox[k];
+        w->mailbox[k].p = NULL;
+        pthread_mutex_unlock(&w->lock);
+        if (s.p != NULL) {
+            w->errors += check(&s, 0x5a);
+            mm_free(s.p);
+        }
+    }
+}
+
+static void *run(void *arg)
+{
+    worker_t *w = arg;
+    slot_t *s;
+    long i;
+
+    for (i = 0; i < nops; i++) {
+        s = &w->slots[rand_r(&w->seed) % SLOTS];
+        if (s->p == NULL) {
+            s->size = pick_size(&w->seed);
+            if ((s->p = mm_malloc(s->size)) == NULL) {
+                fprintf(stderr, "thread %d: out of memory\n", w->id);
+                exit(1);
+            }
+            fill(s, w->id);
+        } else if (rand_r(&w->seed) % 100 < remote_pct) {
+            w->errors += check(s, w->id);
+            memset(s->p, 0x5a, s->size);
+            give(w, s);
+            s->p = NULL;
+        } else {
+            w->errors += check(s, w->id);
+            mm_free(s->p);
+            s->p = NULL;
+        }
+        if ((i & 1023) == 0)
+            collect(w);
+    }
+    for (i = 0; i < SLOTS; i++)
+        if (w->slots[i].p != NULL)
+            mm_free(w->slots[i].p);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    struct timeval start, end;
+    double secs;
+    long errors = 0;
+    int c, i;
+
+    while ((c = getopt(argc, argv, "t:n:r:")) != -1) {
+        switch (c) {
+        case 't': nthreads = atoi(optarg); break;
+        case 'n': nops = atol(optarg); break;
+        case 'r': remote_pct = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-t threads] [-n ops] [-r remote %%]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (nthreads < 1 || nthreads > MAX_THREADS) {
+        fprintf(stderr, "1 to %d threads\n", MAX_THREADS);
+        exit(1);
+    }
+
+    mem_init();
+    if (mm_init() < 0) {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < nthreads; i++) {
+        workers[i].id = i;
+        workers[i].seed = i + 1;
+        pthread_mutex_init(&workers[i].lock, NULL);
+    }
+    for (i = 0; i < nthreads; i++)
+        pthread_create(&workers[i].tid, NULL, run, &workers[i]);
+    for (i = 0; i < nthreads; i++)
+        pthread_join(workers[i].tid, NULL);
+    gettimeofday(&end, NULL);
+
+    for (i = 0; i < nthreads; i++) {
+        collect(&workers[i]);
+        errors += workers[i].errors;
+    }
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+    printf("%d threads, %ld ops: %.3f s, %.0f Kops/s, heap %lu KB, %ld errors\n",
+           nthreads, nthreads * nops, secs, nthreads * nops / secs / 1000,
+           (unsigned long)mem_heapsize() / 1024, errors);
+#ifdef MM_STATS
+    mm_stats(stdout);
+#endif
+    return errors != 0;
+}
@@ -0,0 +1,339 @@
+/*
+ * mm-record.c - record the malloc stream of a real process as a trace
+ *
+ * An LD_PRELOAD shim: malloc, calloc, realloc, free and the memalign
+ * family are passed on to glibc and logged in the .rep format of the
+ * lab's traces, so mdriver and mm-replay can run what a real workload
+ * does. Build and run, e.g. for the stock server:
+ *   gcc -O2 -shared -fPIC -pthread -o mm-record.so mm-record.c
+ *   MM_TRACE=stockserver.rep LD_PRELOAD=./mm-record.so ./stockserver 60001
+ * then drive it with multiclient and stop it; the trace is complete once
+ * the process exits normally.
+ *
+ * Every call is made and logged under one lock, so the trace order is
+ * the order glibc saw, even across threads. Alignment requests are
+ * logged as plain mallocs. Blocks allocated before the trace file is
+ * open are not recorded, and neither are their frees. Only the first
+ * process is recorded: children stop recording at fork(), and programs
+ * it execs find MM_TRACE_ACTIVE set and leave the trace alone. So record
+ * the real binary, not a wrapper that execs it (a pyenv shim, say): exec
+ * skips the destructor, and the trace is left as an empty one.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+extern void __libc_free(void *ptr);
+
+#define HEADER_LINE 21 /* Header fields are rewritten in place at exit */
+#define HEADER_SIZE (4 * HEADER_LINE)
+#define OUTBUF (1 << 16)
+#define TABLE_MIN 4096 /* Slots in the first pointer table, a power of 2 */
+#define TOMBSTONE ((void *)1)
+
+/* Live blocks: pointer -> trace id and size, open addressing */
+typedef struct {
+    void *p;
+    int id;
+    size_t size;
+} slot_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int fd = -1;
+static char outbuf[OUTBUF];
+static size_t outlen;
+static slot_t *table;
+static size_t table_size, table_used; /* used counts tombstones too */
+static int nids;
+static unsigned long nops;
+static size_t live, live_peak;
+
+static size_t slot_of(void *p)
+{
+    return ((size_t)p >> 4) * 0x9e3779b97f4a7c15ULL & (table_size - 1);
+}
+
+/* table_grow - rehash into a table twice as big, or the same size if it is mostly tombstones */
+static int table_grow(void)
+{
+    slot_t *old = table;
+    size_t i, oldsize = table_size, n = 0;
+
+    for (i = 0; i < oldsize; i++)
+	if (old[i].p != NULL && old[i].p != TOMBSTONE)
+	    n++;
+    table_size = oldsize == 0 ? TABLE_MIN : (n * 4 > oldsize ? oldsize * 2 : oldsize);
+    table = mmap(NULL, table_size * sizeof(slot_t), PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (table == MAP_FAILED) {
+	table = old;
+	table_size = oldsize;
+	return -1;
+    }
+    table_used = 0;
+    for (i = 0; i < oldsize; i++) {
+	if (old[i].p != NULL && old[i].p != TOMBSTONE) {
+	    size_t s = slot_of(old[i].p);
+
+	    while (table[s].p != NULL)
+		s = (s + 1) & (table_size - 1);
+	    table[s] = old[i];
+	    table_used++;
+	}
+    }
+    if (old != NULL)
+	munmap(old, oldsize * sizeof(slot_t));
+    return 0;
+}
+
+static void table_put(void *p, int id, size_t size)
+{
+    size_t s;
+
+    if ((table_used + 1) * 2 > table_size && table_grow() < 0)
+	return;
+    s = slot_of(p);
+    while (table[s].p != NULL && table[s].p != TOMBSTONE)
+	s = (s + 1) & (table_size - 1);
+    if (table[s].p == NULL)
+	table_used++;
+    table[s].p = p;
+    table[s].id = id;
+    table[s].size = size;
+}
+
+/* table_take - remove p, returning its slot contents; id -1 if p is unknown */
+static slot_t table_take(void *p)
+{
+    slot_t none = { NULL, -1, 0 }, found;
+    size_t s;
+
+    if (table_size == 0)
+	return none;
+    for (s = slot_of(p); table[s].p != NULL; s = (s + 1) & (table_size - 1)) {
+	if (table[s].p == p) {
+	    found = table[s];
+	    table[s].p = TOMBSTONE;
+	    return found;
+	}
+    }
+    return none;
+}
+
+static void flush(void)
+{
+    size_t off = 0;
+    ssize_t n;
+
+    while (off < outlen) {
+	if ((n = write(fd, outbuf + off, outlen - off)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    break;
+	}
+	off += n;
+    }
+    outlen = 0;
+}
+
+static void emit(char op, int id, size_t size)
+{
+    if (fd < 0)
+	return;
+    if (outlen + 64 > OUTBUF)
+	flush();
+    if (op == 'f')
+	outlen += snprintf(outbuf + outlen, OUTBUF - outlen, "f %d\n", id);
+    else
+	outlen += snprintf(outbuf + outlen, OUTBUF - outlen, "%c %d %lu\n", op, id, (unsigned long)size);
+    nops++;
+}
+
+/* The rec_* helpers run with lock held */
+static void rec_alloc(void *p, size_t size)
+{
+    if (p == NULL || fd < 0)
+	return;
+    table_put(p, nids, size);
+    emit('a', nids++, size);
+    live += size;
+    if (live > live_peak)
+	live_peak = live;
+}
+
+static void rec_free(void *p)
+{
+    slot_t s = table_take(p);
+
+    if (s.id < 0)
+	return;
+    emit('f', s.id, 0);
+    live -= s.size;
+}
+
+static void rec_realloc(void *old, void *p, size_t size)
+{
+    slot_t s = table_take(old);
+
+    if (s.id < 0) {
+	rec_alloc(p, size);
+	return;
+    }
+    table_put(p, s.id, size);
+    emit('r', s.id, size);
+    live += size - s.size;
+    if (live > live_peak)
+	live_peak = live;
+}
+
+static void fork_prepare(void)
+{
+    pthread_mutex_lock(&lock);
+}
+
+static void fork_parent(void)
+{
+    pthread_mutex_unlock(&lock);
+}
+
+/* write_header - heap size hint, ids, ops, weight, in fixed-width fields at the start of the file */
+static void write_header(void)
+{
+    char header[HEADER_SIZE + 1];
+
+    snprintf(header, sizeof(header), "%-20lu\n%-20d\n%-20lu\n%-20d\n",
+	     (unsigned long)live_peak, nids, nops, 1);
+    pwrite(fd, header, HEADER_SIZE, 0);
+}
+
+/* fork_child - the child drops the parent's unwritten ops and its own */
+static void fork_child(void)
+{
+    if (fd >= 0)
+	close(fd);
+    fd = -1;
+    outlen = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+__attribute__((constructor))
+static void record_start(void)
+{
+    const char *path = getenv("MM_TRACE");
+
+    if (getenv("MM_TRACE_ACTIVE") != NULL)
+	return;
+    setenv("MM_TRACE_ACTIVE", "1", 1);
+    if (path == NULL)
+	path = "mm-trace.rep";
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+	return;
+    write_header();     //An empty trace until record_stop, in case exec skips it
+    lseek(fd, HEADER_SIZE, SEEK_SET);
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+}
+
+/* record_stop - flush the ops and fill in the header */
+__attribute__((destructor))
+static void record_stop(void)
+{
+    pthread_mutex_lock(&lock);
+    if (fd >= 0) {
+	flush();
+	write_header();
+	close(fd);
+	fd = -1;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void *malloc(size_t size)
+{
+    void *p;
+
+    pthread_mutex_lock(&lock);
+    p = __libc_malloc(size);
+    rec_alloc(p, size);
+    pthread_mutex_unlock(&lock);
+    return p;
+}
+
+void *calloc(size_t n, size_t size)
+{
+    void *p;
+
+    pthread_mutex_lock(&lock);
+    p = __libc_calloc(n, size);
+    rec_alloc(p, n * size);
+    pthread_mutex_unlock(&lock);
+    return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    if (ptr == NULL)
+	return malloc(size);
+    if (size == 0) {
+	free(ptr);
+	return NULL;
+    }
+    pthread_mutex_lock(&lock);
+    if ((p = __libc_realloc(ptr, size)) != NULL)
+	rec_realloc(ptr, p, size);
+    pthread_mutex_unlock(&lock);
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL)
+	return;
+    pthread_mutex_lock(&lock);
+    rec_free(ptr);
+    __libc_free(ptr);
+    pthread_mutex_unlock(&lock);
+}
+
+void *memalign(size_t align, size_t size)
+{
+    void *p;
+
+    pthread_mutex_lock(&lock);
+    p = __libc_memalign(align, size);
+    rec_alloc(p, size);
+    pthread_mutex_unlock(&lock);
+    return p;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    return memalign(align, size);
+}
+
+int posix_memalign(void **res, size_t align, size_t size)
+{
+    void *p;
+
+    if (align < sizeof(void *) || (align & (align - 1)) != 0)
+	return EINVAL;
+    if ((p = memalign(align, size)) == NULL)
+	return ENOMEM;
+    *res = p;
+    return 0;
+}
+
+void *valloc(size_t size)
+{
+    return memalign(sysconf(_SC_PAGESIZE), size);
+}
@@ -0,0 +1,272 @@
+/*
+ * mm-replay.c - replay .rep traces against an allocator
+ *
+ * Runs each trace once with payload checks to measure peak utilization
+ * (peak requested bytes over the allocator's footprint), then -n more
+ * times without checks and reports the best throughput. Traces are
+ * the lab's .rep format, hand written or captured with mm-record.so.
+ *
+ * Build next to the lab's memlib.c and mm.h, against any mm.c variant:
+ *   gcc -O2 -o replay mm-replay.c mm.c memlib.c
+ * or against glibc, whose footprint is taken from mallinfo2:
+ *   gcc -O2 -DREPLAY_LIBC -o replay-libc mm-replay.c
+ * With -DMM_STATS the allocator's report follows each checked run.
+ * memlib's heap is fixed in size, so traces from long-running processes
+ * may need a larger MAX_HEAP in memlib.h.
+ *
+ * usage: replay [-n runs] trace.rep ...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#ifdef REPLAY_LIBC
+#include <malloc.h>
+#define mm_malloc malloc
+#define mm_free free
+#define mm_realloc realloc
+#else
+#include "mm.h"
+#include "memlib.h"
+#endif
+#ifdef MM_STATS
+void mm_stats(FILE *fp);
+#endif
+
+typedef struct {
+    char type; /* 'a', 'r' or 'f' */
+    int id;
+    size_t size;
+} op_t;
+
+typedef struct {
+    int num_ids;
+    int num_ops;
+    size_t max_size; /* Largest request, sizes the check pattern */
+    op_t *ops;
+} trace_t;
+
+#define PATTERN_IDS 256 /* Ids with different offsets into the pattern */
+
+static char *pattern; /* Check contents: block id holds pattern + id % PATTERN_IDS */
+
+static int read_trace(const char *path, trace_t *t)
+{
+    FILE *fp;
+    long heap, weight;
+    char type[2];
+    unsigned long size;
+    int i;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+	perror(path);
+	return -1;
+    }
+    if (fscanf(fp, "%ld %d %d %ld", &heap, &t->num_ids, &t->num_ops, &weight) != 4) {
+	fprintf(stderr, "%s: bad header\n", path);
+	fclose(fp);
+	return -1;
+    }
+    if ((t->ops = malloc(t->num_ops * sizeof(op_t))) == NULL) {
+	fclose(fp);
+	return -1;
+    }
+    t->max_size = 0;
+    for (i = 0; i < t->num_ops; i++) {
+	if (fscanf(fp, "%1s %d", type, &t->ops[i].id) != 2)
+	    break;
+	t->ops[i].type = type[0];
+	t->ops[i].size = 0;
+	if (type[0] != 'f' && fscanf(fp, "%lu", &size) == 1)
+	    t->ops[i].size = size;
+	if (t->ops[i].size > t->max_size)
+	    t->max_size = t->ops[i].size;
+	if (t->ops[i].id < 0 || t->ops[i].id >= t->num_ids
+	    || (type[0] != 'a' && type[0] != 'r' && type[0] != 'f'))
+	    break;
+    }
+    fclose(fp);
+    if (i < t->num_ops) {
+	fprintf(stderr, "%s: bad op %d\n", path, i);
+	free(t->ops);
+	return -1;
+    }
+    return 0;
+}
+
+/* footprint - bytes the allocator holds from the system */
+static size_t footprint(void)
+{
+#ifdef REPLAY_LIBC
+    struct mallinfo2 mi = mallinfo2();
+
+    return mi.arena + mi.hblkhd;
+#else
+    return mem_heapsize();
+#endif
+}
+
+/* fill - write the check contents of block id into its first size bytes */
+static void fill(char *p, int id, size_t size)
+{
+    memcpy(p, pattern + id % PATTERN_IDS, size);
+}
+
+/* intact - 1 if the first size bytes of block id still hold its contents */
+static int intact(char *p, int id, size_t size)
+{
+    return memcmp(p, pattern + id % PATTERN_IDS, size) == 0;
+}
+
+/* start - give the allocator a fresh heap */
+static int start(void)
+{
+#ifdef REPLAY_LIBC
+    return 0;
+#else
+    mem_reset_brk();
+    return mm_init();
+#endif
+}
+
+/*
+ * replay - run the trace once. With check set, fill every payload from
+ * the pattern at an offset set by its id, compare the whole payload
+ * before realloc and free and the part realloc keeps after it, and
+ * track utilization.
+ * Blocks the trace leaves allocated are freed at the end.
+ */
+static long replay(trace_t *t, char **blocks, size_t *sizes, int check, double *util)
+{
+    size_t live = 0, peak = 0, peak_footprint = 0;
+    long errors = 0;
+    op_t *op;
+    char *p;
+    int i;
+
+    if (start() < 0) {
+	fprintf(stderr, "mm_init failed\n");
+	exit(1);
+    }
+    memset(blocks, 0, t->num_ids * sizeof(char *));
+    memset(sizes, 0, t->num_ids * sizeof(size_t));
+    for (i = 0; i < t->num_ops; i++) {
+	op = &t->ops[i];
+	switch (op->type) {
+	case 'a':
+	    if ((p = mm_malloc(op->size)) == NULL && op->size > 0) {
+		fprintf(stderr, "op %d: out of memory\n", i);
+		return errors + 1;
+	    }
+	    blocks[op->id] = p;
+	    sizes[op->id] = op->size;
+	    if (check) {
+		fill(p, op->id, op->size);
+		live += op->size;
+	    }
+	    break;
+	case 'r':
+	    if (check && !intact(blocks[op->id], op->id, sizes[op->id]))
+		errors++;
+	    if ((p = mm_realloc(blocks[op->id], op->size)) == NULL && op->size > 0) {
+		fprintf(stderr, "op %d: out of memory\n", i);
+		return errors + 1;
+	    }
+	    if (check) {
+		if (!intact(p, op->id, op->size < sizes[op->id] ? op->size : sizes[op->id]))
+		    errors++;
+		fill(p, op->id, op->size);
+		live += op->size - sizes[op->id];
+	    }
+	    blocks[op->id] = p;
+	    sizes[op->id] = op->size;
+	    break;
+	case 'f':
+	    if (blocks[op->id] == NULL)
+		break;
+	    if (check) {
+		if (!intact(blocks[op->id], op->id, sizes[op->id]))
+		    errors++;
+		live -= sizes[op->id];
+	    }
+	    mm_free(blocks[op->id]);
+	    blocks[op->id] = NULL;
+	    break;
+	}
+	if (check) {
+	    peak = live > peak ? live : peak;
+	    peak_footprint = footprint() > peak_footprint ? footprint() : peak_footprint;
+	}
+    }
+#ifdef MM_STATS
+    if (check)
+	mm_stats(stdout);
+#endif
+    for (i = 0; i < t->num_ids; i++)
+	if (blocks[i] != NULL)
+	    mm_free(blocks[i]);
+    if (check)
+	*util = peak_footprint ? 100.0 * peak / peak_footprint : 0.0;
+    return errors;
+}
+
+int main(int argc, char **argv)
+{
+    struct timeval t0, t1;
+    trace_t t;
+    char **blocks;
+    size_t *sizes;
+    double util, secs, best;
+    long errors;
+    int c, runs = 10, i, status = 0;
+    size_t j;
+
+    while ((c = getopt(argc, argv, "n:")) != -1) {
+	switch (c) {
+	case 'n': runs = atoi(optarg); break;
+	default:
+	    fprintf(stderr, "usage: %s [-n runs] trace.rep ...\n", argv[0]);
+	    exit(1);
+	}
+    }
+    if (optind == argc) {
+	fprintf(stderr, "usage: %s [-n runs] trace.rep ...\n", argv[0]);
+	exit(1);
+    }
+#ifndef REPLAY_LIBC
+    mem_init();
+#endif
+
+    printf("%-30s %10s %8s %10s %7s\n", "trace", "ops", "util", "Kops/s", "errors");
+    for (; optind < argc; optind++) {
+	if (read_trace(argv[optind], &t) < 0) {
+	    status = 1;
+	    continue;
+	}
+	blocks = malloc(t.num_ids * sizeof(char *));
+	sizes = malloc(t.num_ids * sizeof(size_t));
+	pattern = realloc(pattern, t.max_size + PATTERN_IDS);
+	for (j = 0; j < t.max_size + PATTERN_IDS; j++)
+	    pattern[j] = rand();
+
+	errors = replay(&t, blocks, sizes, 1, &util);
+	best = 0;
+	for (i = 0; i < runs && errors == 0; i++) {
+	    gettimeofday(&t0, NULL);
+	    replay(&t, blocks, sizes, 0, NULL);
+	    gettimeofday(&t1, NULL);
+	    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+	    if (best == 0 || secs < best)
+		best = secs;
+	}
+	printf("%-30s %10d %7.1f%% %10.0f %7ld\n", argv[optind], t.num_ops, util,
+	       best > 0 ? t.num_ops / best / 1000 : 0.0, errors);
+	status |= errors != 0;
+	free(blocks);
+	free(sizes);
+	free(t.ops);
+    }
+    return status;
+}
@@ -9,11 +9,16 @@
  * NOTE TO STUDENTS: Replace this header comment with your own header
  * comment that gives a high level description of your solution.
  */
+#define _GNU_SOURCE /* mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <sys/mman.h>
+#ifdef MM_THREADS
+#include <pthread.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
@@ -43,38 +48,254 @@ team_t team = {
 #define ALIGN(size) (((size) + (ALIGNMENT - 1)) & ~0x7)
 
 
+/*
+ * Block layout, the same on 32- and 64-bit builds. Every word is 4
+ * bytes. Headers hold the size, an allocated bit and a bit telling
+ * whether the block before is allocated. Only free blocks have a
+ * footer, so an allocated block is its header plus payload:
+ *
+ *   allocated: [hdr | payload ...                      ]
+ *   free:      [hdr | next | prev | ...           | ftr]
+ *
+ * next/prev are 32-bit offsets from the bottom of the heap (0 = NULL),
+ * so the minimum block is 16 bytes whatever the pointer size.
+ */
 #define WSIZE 4 /* Word and header/footer size (bytes) */
 #define DSIZE 8 /* Double word size (bytes) */
 #define CHUNKSIZE (1<<12) /* Extend heap by this amount (bytes) */
-#define SIZE_MAX (1<<30)
 
-/* Pack a size and allocated bit into a word */
+/* Pack a size and allocated bits into a word */
 #define PACK(size, alloc) ((size) | (alloc))
+#define PREV_ALLOC 0x2 /* Header bit: the block before is allocated */
+#define MMAPPED 0x4 /* Header bit: the block has a mapping of its own */
 
 /* Read and write a word at address p */
-#define GET(p) (*(size_t *)(p))
-#define PUT(p, val) (*(size_t *)(p) = (val))
+#define GET(p) (*(unsigned int *)(p))
+#define PUT(p, val) (*(unsigned int *)(p) = (unsigned int)(val))
 
 /* Read the size and allocated fields from address p */
 #define GET_SIZE(p) (GET(p) & ~0x7)
 #define GET_ALLOC(p) (GET(p) & 0x1)
-/* Given block ptr bp, compute address of its header and footer */
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
+#define IS_MMAPPED(p) (GET(p) & MMAPPED)
+#define SET_PREV_ALLOC(p) PUT(p, GET(p) | PREV_ALLOC)
+#define CLEAR_PREV_ALLOC(p) PUT(p, GET(p) & ~PREV_ALLOC)
+/* Given block ptr bp, compute address of its header and footer (free blocks only) */
 #define HDRP(bp) ((char *)(bp) - WSIZE)
 #define FTRP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
-/* Given block ptr bp, compute address of next and previous blocks */
+/* Given block ptr bp, compute address of next and previous blocks (the latter only if free) */
 #define NEXT_BLKP(bp) ((char *)(bp) + GET_SIZE((char *)(bp) - WSIZE))
 #define PREV_BLKP(bp) ((char *)(bp) - GET_SIZE((char *)(bp) - DSIZE))
 
-#define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
-
 #define NEXT_FREE_BLKP(bp) ((char *)(bp))
 #define PREV_FREE_BLKP(bp) ((char *)(bp) + WSIZE)
 
+/* Heap offsets stand in for pointers in free list links and list heads */
+#define TO_OFFSET(p) ((p) != NULL ? (unsigned int)((char *)(p) - seg_listp) : 0)
+#define FROM_OFFSET(o) ((o) != 0 ? seg_listp + (o) : NULL)
+
+/* Free list links of a free block, NULL at either end */
+#define NEXT_FREE(bp) FROM_OFFSET(GET(NEXT_FREE_BLKP(bp)))
+#define PREV_FREE(bp) FROM_OFFSET(GET(PREV_FREE_BLKP(bp)))
+#define SET_NEXT_FREE(bp, p) PUT(NEXT_FREE_BLKP(bp), TO_OFFSET(p))
+#define SET_PREV_FREE(bp, p) PUT(PREV_FREE_BLKP(bp), TO_OFFSET(p))
+
+/*
+ * Segregated free lists: class c holds free blocks of size
+ * [MIN_BLOCK << c, MIN_BLOCK << (c+1)), the last class everything larger.
+ * Each list is kept sorted by size, so the first fit in a class is its
+ * best fit and the head of any larger class is the smallest block there.
+ * The list heads live at the bottom of the heap, below the prologue.
+ */
+#define MIN_BLOCK (2 * DSIZE)
+#define NUM_CLASSES 20
+#define HEAD(i) FROM_OFFSET(GET(seg_listp + (i) * WSIZE))
+#define SET_HEAD(i, p) PUT(seg_listp + (i) * WSIZE, TO_OFFSET(p))
+#define SEG_LIST(c) HEAD(c)
+#define SET_SEG_LIST(c, p) SET_HEAD(c, p)
+
+/*
+ * Build with -DMM_TREE to keep every free block in one splay tree
+ * instead, keyed by (size, address) so keys are unique. The two links
+ * become the left and right children, and the root sits in the first
+ * list head. A best-fit search splays the smallest block of at least
+ * the requested size to the top, so lookups, inserts and deletes are
+ * O(log n) amortized. The size classes then only label statistics.
+ */
+#ifdef MM_TREE
+#define TREE_ROOT HEAD(0)
+#define SET_TREE_ROOT(p) SET_HEAD(0, p)
+#define LEFT(bp) NEXT_FREE(bp)
+#define RIGHT(bp) PREV_FREE(bp)
+#define SET_LEFT(bp, p) SET_NEXT_FREE(bp, p)
+#define SET_RIGHT(bp, p) SET_PREV_FREE(bp, p)
+/* Key (size, addr) comes before / after block bp */
+#define KEY_LT(size, addr, bp) ((size) < GET_SIZE(HDRP(bp)) || ((size) == GET_SIZE(HDRP(bp)) && (char *)(addr) < (char *)(bp)))
+#define KEY_GT(size, addr, bp) ((size) > GET_SIZE(HDRP(bp)) || ((size) == GET_SIZE(HDRP(bp)) && (char *)(addr) > (char *)(bp)))
+#endif
+
+/* Block size for a request of size bytes: header and alignment */
+#define BLOCK_SIZE(size) MAX(MIN_BLOCK, ALIGN((size) + WSIZE))
+
+/*
+ * Large blocks: requests of MMAP_THRESHOLD bytes or more get a mapping
+ * of their own, which goes back to the OS on free, so one huge buffer
+ * does not grow the heap for good. The mapping starts with its length;
+ * the block header after it has size 0 and the MMAPPED bit. memlib
+ * cannot lower the break, so instead a free block at the end of the
+ * heap has its pages released once TRIM_THRESHOLD bytes of them have
+ * been used since they were last released.
+ */
+#ifndef MMAP_THRESHOLD
+#define MMAP_THRESHOLD (128 * 1024) /* -DMMAP_THRESHOLD=0 keeps everything in the heap */
+#endif
+#ifndef TRIM_THRESHOLD
+#define TRIM_THRESHOLD (128 * 1024)
+#endif
+#define MMAP_OVERHEAD (2 * DSIZE) /* Mapping length, padding, block header */
+#define MMAP_LEN(bp) (*(size_t *)((char *)(bp) - MMAP_OVERHEAD))
+#define USE_MMAP(size) (MMAP_THRESHOLD > 0 && (size) >= MMAP_THRESHOLD)
+
+/*
+ * Quick lists: a freed heap block of at most QUICK_MAX bytes is not
+ * coalesced but pushed on the list for its exact size, still marked
+ * allocated, and the next malloc of that size pops it. The blocks are
+ * coalesced all at once when QUICK_QUOTA of them are waiting or when
+ * best_fit finds nothing. Their heads follow the slab list heads.
+ */
+#define QUICK_MAX 256
+#define QUICK_QUOTA 128
+#define QUICK_BINS (QUICK_MAX / DSIZE) /* One per block size, MIN_BLOCK to QUICK_MAX */
+#define QUICK_BIN(size) ((size) / DSIZE - 1)
+#define QUICK_LIST(b) HEAD(NUM_CLASSES + SLAB_CLASSES + 2 + (b))
+#define SET_QUICK_LIST(b, p) SET_HEAD(NUM_CLASSES + SLAB_CLASSES + 2 + (b), p)
+
+/*
+ * Slabs: requests of at most SLAB_MAX bytes are served from SLAB_SIZE
+ * pages carved into equal objects, one object size per slab class.
+ * Objects have no header or footer. The page map records which pages
+ * are slabs, and the slab header at the start of the page gives the
+ * object size. To the rest of the heap a slab is an ordinary allocated
+ * block of exactly SLAB_SIZE, so slabs taken SLAB_RUN at a time tile
+ * the pages with no gaps. Slabs with a free object are on their class
+ * list; unused pages wait on the page list. Both list heads sit after
+ * the free list heads.
+ */
+#define SLAB_SIZE 4096 /* Also the alignment of every slab */
+#define SLAB_RUN 8 /* Pages taken from the heap at once */
+#define SLAB_MAX 64
+#define SLAB_CLASSES (SLAB_MAX / ALIGNMENT) /* Object sizes ALIGNMENT, 2*ALIGNMENT, ... */
+#define SLAB_CLASS(size) (((size) - 1) / ALIGNMENT)
+#define SLAB_LIST(c) ((slab_t *)HEAD(NUM_CLASSES + (c)))
+#define SET_SLAB_LIST(c, s) SET_HEAD(NUM_CLASSES + (c), s)
+#define FREE_PAGES ((slab_t *)HEAD(NUM_CLASSES + SLAB_CLASSES))
+#define SET_FREE_PAGES(s) SET_HEAD(NUM_CLASSES + SLAB_CLASSES, s)
+#define NUM_HEADS (NUM_CLASSES + SLAB_CLASSES + 2 + QUICK_BINS) /* Even, so the prologue stays double word aligned */
+#define SLAB_OF(bp) ((slab_t *)((size_t)(bp) & ~(size_t)(SLAB_SIZE - 1)))
+/* Page index from the heap's first (possibly partial) page; memlib's heap need not be page aligned */
+#define PAGE_OF(bp) ((size_t)(bp) / SLAB_SIZE - (size_t)mem_heap_lo() / SLAB_SIZE)
+#define PAGEMAP_MIN 64 /* Pages covered by the first page map */
+
+typedef struct slab {
+    struct slab *next; /* Class list, NULL at either end */
+    struct slab *prev;
+    char *free; /* Freed objects, linked through their first word */
+    char *bump; /* First object never handed out */
+    int objsize;
+    int inuse; /* On the page list: pages in the list from here on */
+    int capacity;
+} slab_t;
+
+typedef struct {
+    size_t len; /* Pages covered */
+    unsigned char map[]; /* Nonzero for a slab page */
+} pagemap_t;
+
 static char *heap_listp;
-static char *free_listp;
+static char *seg_listp;
+static pagemap_t *pagemap;
+static int quick_count; /* Blocks on the quick lists */
+static char *heap_dirty; /* End of the heap used since the last trim */
+
+/*
+ * Build with -DMM_THREADS -pthread for the thread-safe variant. The heap
+ * above is then the central heap, guarded by heap_lock, and each thread
+ * keeps a cache of small free blocks (see tcache_malloc) so most small
+ * mallocs and frees never take the lock.
+ */
+#ifdef MM_THREADS
+#ifndef TCACHE_MAX
+#define TCACHE_MAX 512 /* Largest cached block; -DTCACHE_MAX=0 disables the caches */
+#endif
+#define TCACHE_BINS (TCACHE_MAX / DSIZE + 1) /* One bin per block size, then one per slab class */
+#define TCACHE_FILL 32 /* Blocks a bin holds before half of them go back */
+#define TCACHE_BATCH 16 /* Blocks moved per refill or flush */
+#define TC_BIN(size) ((size) / DSIZE)
+#define TC_SLAB_BIN(c) (TCACHE_BINS + (c))
+#define TC_NEXT(bp) (*(char **)(bp))
+
+typedef struct {
+    char *bins[TCACHE_BINS + SLAB_CLASSES]; /* Cached blocks, linked through the first payload word */
+    int count[TCACHE_BINS + SLAB_CLASSES];
+} tcache_t;
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+static int heap_epoch; /* Bumped by mm_init; older caches point into a dead heap */
+static __thread tcache_t *tcache;
+static __thread int tcache_epoch;
+
+#define HEAP_LOCK() pthread_mutex_lock(&heap_lock)
+#define HEAP_UNLOCK() pthread_mutex_unlock(&heap_lock)
+#else
+#define HEAP_LOCK()
+#define HEAP_UNLOCK()
+#endif
+
+/*
+ * Build with -DMM_STATS to count what the allocator does and print it
+ * with mm_stats() after a trace run. Counters are updated with atomic
+ * adds, so the MM_THREADS build can be profiled as well. Live and
+ * footprint figures are in block bytes (payload plus header and
+ * rounding); internal fragmentation is the share of those bytes that
+ * was not requested, summed over every malloc.
+ */
+#ifdef MM_STATS
+#define STATS_SAMPLES 256 /* Kept evenly spaced by doubling the interval */
+#define STATS_INTERVAL 64 /* Initial mallocs and frees between samples */
 
-/* always points to the prologue block, which is an 8-byte allocated block consisting of only a header and a footer */
+typedef struct {
+    unsigned long ops;
+    size_t heap, mapped, live;
+} stats_sample_t;
+
+static struct {
+    unsigned long heap_mallocs[NUM_CLASSES]; /* By the class of the block handed out */
+    unsigned long slab_mallocs[SLAB_CLASSES];
+    unsigned long mmap_mallocs;
+    unsigned long frees;
+    unsigned long reallocs, realloc_moves;
+    unsigned long req_bytes, block_bytes;
+    unsigned long searches, search_steps, search_max; /* Free blocks looked at by best_fit */
+    size_t live, live_peak; /* Block bytes held by the caller */
+    size_t mapped, mapped_peak; /* Bytes in mmap_malloc mappings */
+    size_t heap_peak;
+    unsigned long ops, interval;
+    int nsamples;
+    stats_sample_t samples[STATS_SAMPLES];
+} mm_stat;
+#ifdef MM_THREADS
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+#define STAT_ADD(f, n) __atomic_fetch_add(&mm_stat.f, (n), __ATOMIC_RELAXED)
+#else
+#define STAT_ADD(f, n)
+#endif
+
+/* heap_listp always points to the prologue block, which is an 8-byte allocated block consisting of only a header and a footer */
 
 extern int mm_init (void);
 extern void *mm_malloc (size_t size);
@@ -89,6 +310,49 @@ static void printblock(void *bp);
 static void checkblock(void *bp);
 static void insert_free(void *bp);
 static void delete_free(void *bp);
+#if !defined(MM_TREE) || defined(MM_STATS)
+static int size_class(size_t size);
+#endif
+#ifdef MM_TREE
+static char *splay(char *t, size_t size, char *addr);
+#endif
+static void *heap_malloc(size_t asize);
+static void heap_free(void *bp);
+static void *heap_memalign(size_t align, size_t asize);
+static void trim_block(void *bp, size_t asize);
+static void *mmap_malloc(size_t size);
+static void mmap_free(void *bp);
+static void heap_trim(void *bp);
+static void heap_touch(void *end);
+static void quick_free(void *bp);
+static void quick_flush(void);
+static void *slab_malloc(int c);
+static void slab_free(void *bp);
+static slab_t *slab_new(int c);
+static void page_free(slab_t *s);
+static void slab_link(slab_t *s, int c);
+static void slab_unlink(slab_t *s, int c);
+static int is_slab(void *bp);
+static int pagemap_set(void *bp, int val);
+#ifdef MM_THREADS
+static void *tcache_malloc(int bin, size_t asize);
+static int tcache_free(void *bp, int bin);
+static tcache_t *tcache_get(void);
+static void tcache_flush(tcache_t *tc, int bin, int n);
+static void tcache_destroy(void *arg);
+static void tcache_key_init(void);
+#endif
+static void *alloc_block(size_t size);
+static void free_block(void *bp);
+static void *realloc_block(void *ptr, size_t size);
+#ifdef MM_STATS
+void mm_stats(FILE *fp);
+static void stats_malloc(void *bp, size_t size);
+static void stats_live(void *bp, int sign);
+static void stats_op(void);
+static size_t stats_size(void *bp);
+static void stats_max(size_t *p, size_t val);
+#endif
 
 
 /* 
@@ -96,16 +360,30 @@ static void delete_free(void *bp);
  */
 int mm_init(void)
 {
+	int c;
+
 	heap_listp = NULL;
 
-	if ((heap_listp = mem_sbrk(8 * WSIZE)) == (void *) - 1)
+	if ((seg_listp = mem_sbrk(NUM_HEADS * WSIZE + 4 * WSIZE)) == (void *) - 1)
 		return -1;
+	for (c = 0; c < NUM_HEADS; c++)
+		SET_HEAD(c, NULL);
+	pagemap = NULL;
+	quick_count = 0;
+	heap_dirty = (char *)~(size_t)0; /* A reset heap still has the pages of the last run */
+	heap_listp = seg_listp + NUM_HEADS * WSIZE;
 	PUT(heap_listp, 0);								/* Alignment padding */
-	PUT(heap_listp + (1 * WSIZE), PACK(DSIZE, 1));	/* Prologue header */
+	PUT(heap_listp + (1 * WSIZE), PACK(DSIZE, 1 | PREV_ALLOC));	/* Prologue header */
 	PUT(heap_listp + (2 * WSIZE), PACK(DSIZE, 1));	/* Prologue footer */
-	PUT(heap_listp + (3 * WSIZE), PACK(0, 1));		/* Epilogue header */
+	PUT(heap_listp + (3 * WSIZE), PACK(0, 1 | PREV_ALLOC));		/* Epilogue header */
 	heap_listp += DSIZE;
-	free_listp = heap_listp + DSIZE;
+#ifdef MM_THREADS
+	heap_epoch++;
+#endif
+#ifdef MM_STATS
+	memset(&mm_stat, 0, sizeof(mm_stat));
+	mm_stat.interval = STATS_INTERVAL;
+#endif
 	
 	/* Extend the empty heap with a free block of CHUNKISZE byte */
 	if (extend_heap(4) == NULL)
@@ -118,23 +396,80 @@ int mm_init(void)
  *     Always allocate a block whose size is a multiple of the alignment.
  */
 void *mm_malloc(size_t size)
+{
+    void *bp = alloc_block(size);
+
+#ifdef MM_STATS
+    if (bp != NULL)
+	stats_malloc(bp, size);
+#endif
+    return bp;
+}
+
+/*
+ * alloc_block - pick the allocator for size: a mapping, a slab, the
+ * thread cache or the heap
+ */
+static void *alloc_block(size_t size)
 {
     size_t asize;      /* adjusted block size */
-    size_t extendsize; /* amount to extend heap if no fit */
     char *bp;
 
     /* Ignore spurious requests */
     if (size <= 0)
 	return NULL;
 
+    /* Large requests get their own mapping */
+    if (USE_MMAP(size))
+	return mmap_malloc(size);
+
+    /* Small requests come from a slab, without per-object overhead */
+    if (size <= SLAB_MAX) {
+#ifdef MM_THREADS
+	if (TCACHE_MAX > 0)
+	    return tcache_malloc(TC_SLAB_BIN(SLAB_CLASS(size)), 0);
+#endif
+	HEAP_LOCK();
+	bp = slab_malloc(SLAB_CLASS(size));
+	HEAP_UNLOCK();
+	return bp;
+    }
+
     /* Adjust block size to include overhead and alignment reqs. */
-    if (size <= DSIZE)
-	asize = DSIZE + DSIZE;
-    else
-	asize = DSIZE * ((size + (DSIZE) + (DSIZE-1)) / DSIZE);              //가로 안은 할당할 블록의 개수를 뜻함. size에 DSIZE-1을 더하고 DSIZE로 나누면, 최소 size보다 같거나 하나 더 큰 word의 개수가 만들어짐. size가 DSIZE로 나누어떨어지면 상관이 없지만, 그렇지 않으면, word를 하나더 생성해줘야함. double word alignment 만족.
+    asize = BLOCK_SIZE(size);              //헤더 한 word를 더하고 DSIZE 배수로 올림. 할당된 블록에는 footer가 없으므로 payload가 그 자리까지 씀. double word alignment 만족.
+
+#ifdef MM_THREADS
+    if (asize <= TCACHE_MAX)
+	return tcache_malloc(TC_BIN(asize), asize);
+#endif
+    HEAP_LOCK();
+    bp = heap_malloc(asize);
+    HEAP_UNLOCK();
+    return bp;
+}
+/* $end mmmalloc */
+
+/*
+ * heap_malloc - allocate from the (central) heap; caller holds heap_lock
+ */
+static void *heap_malloc(size_t asize)
+{
+    size_t extendsize; /* amount to extend heap if no fit */
+    char *bp;
 
-    /* Search the free list for a fit */
-    if ((bp = best_fit(asize)) != NULL) {
+    /* A block of the same size freed lately is still marked allocated */
+    if (asize <= QUICK_MAX && (bp = QUICK_LIST(QUICK_BIN(asize))) != NULL) {
+	SET_QUICK_LIST(QUICK_BIN(asize), NEXT_FREE(bp));
+	quick_count--;
+	return bp;
+    }
+
+    /* Search the free list for a fit, coalescing the quick lists if that fails */
+    if ((bp = best_fit(asize)) == NULL && quick_count > 0) {
+	quick_flush();
+	bp = best_fit(asize);
+    }
+    if (bp != NULL) {
 	place(bp, asize);
 	return bp;
     }
@@ -146,27 +481,351 @@ void *mm_malloc(size_t size)
     place(bp, asize);
     return bp;
 }
-/* $end mmmalloc */
 
 /*
- * mm_free - Freeing a block does nothing.
+ * mm_free - 블록을 해제하고 인접한 빈 블록과 결합
  */
 void mm_free(void *bp)
+{
+#ifdef MM_STATS
+    STAT_ADD(frees, 1);
+    stats_live(bp, -1);
+    stats_op();
+#endif
+    free_block(bp);
+}
+
+static void free_block(void *bp)
+{
+    if (is_slab(bp)) {
+#ifdef MM_THREADS
+	if (TCACHE_MAX > 0 && tcache_free(bp, TC_SLAB_BIN(SLAB_CLASS(SLAB_OF(bp)->objsize))))
+	    return;
+#endif
+	HEAP_LOCK();
+	slab_free(bp);
+	HEAP_UNLOCK();
+	return;
+    }
+    if (IS_MMAPPED(HDRP(bp))) {
+	mmap_free(bp);
+	return;
+    }
+#ifdef MM_THREADS
+    if (GET_SIZE(HDRP(bp)) <= TCACHE_MAX && tcache_free(bp, TC_BIN(GET_SIZE(HDRP(bp)))))
+	return;
+#endif
+    HEAP_LOCK();
+    if (GET_SIZE(HDRP(bp)) <= QUICK_MAX)
+	quick_free(bp);
+    else
+	heap_free(bp);
+    HEAP_UNLOCK();
+}
+
+/*
+ * heap_free - return a block to the (central) heap; caller holds heap_lock
+ */
+static void heap_free(void *bp)
 {
     size_t size = GET_SIZE(HDRP(bp));
 
-    PUT(HDRP(bp), PACK(size, 0));
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
     PUT(FTRP(bp), PACK(size, 0));
+    CLEAR_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+
+    bp = coalesce(bp);
+    if (GET_SIZE(HDRP(NEXT_BLKP(bp))) == 0 && GET_SIZE(HDRP(bp)) >= TRIM_THRESHOLD)
+	heap_trim(bp);
+}
+
+/*
+ * heap_memalign - allocate a block of asize whose payload is aligned to
+ * align, by over-allocating and freeing the unaligned lead and the tail.
+ * Caller holds heap_lock.
+ */
+static void *heap_memalign(size_t align, size_t asize)
+{
+    char *bp, *abp;
+    size_t csize, lead;
+
+    if ((bp = heap_malloc(asize + align + MIN_BLOCK)) == NULL)
+	return NULL;
+    csize = GET_SIZE(HDRP(bp));
+
+    /* The lead must be big enough to stand as a free block of its own */
+    abp = bp;
+    if ((size_t)bp & (align - 1))
+	abp = (char *)(((size_t)bp + MIN_BLOCK + align - 1) & ~(align - 1));
+    lead = abp - bp;
+    if (lead > 0) {
+	PUT(HDRP(abp), PACK(csize - lead, 1 | PREV_ALLOC));
+	PUT(HDRP(bp), PACK(lead, 1 | GET_PREV_ALLOC(HDRP(bp))));
+	heap_free(bp);
+    }
+    trim_block(abp, asize);
+    return abp;
+}
+
+/*
+ * trim_block - shrink an allocated block to asize, freeing the tail if
+ * it can stand as a block of its own. Caller holds heap_lock.
+ */
+static void trim_block(void *bp, size_t asize)
+{
+    size_t csize = GET_SIZE(HDRP(bp));
+    char *tail;
+
+    if (csize - asize < MIN_BLOCK) {
+	heap_touch((char *)bp + csize);
+	return;
+    }
+    heap_touch((char *)bp + asize);
+    PUT(HDRP(bp), PACK(asize, 1 | GET_PREV_ALLOC(HDRP(bp))));
+    tail = NEXT_BLKP(bp);
+    PUT(HDRP(tail), PACK(csize - asize, 1 | PREV_ALLOC));
+    heap_free(tail);
+}
+
+/* quick_free - defer coalescing bp, unless the quota is used up */
+static void quick_free(void *bp)
+{
+    int b = QUICK_BIN(GET_SIZE(HDRP(bp)));
 
-    coalesce(bp);
+    if (quick_count >= QUICK_QUOTA)
+	quick_flush();
+    SET_NEXT_FREE(bp, QUICK_LIST(b));
+    SET_QUICK_LIST(b, bp);
+    quick_count++;
+}
+
+/* quick_flush - really free every block on the quick lists */
+static void quick_flush(void)
+{
+    char *bp;
+    int b;
+
+    for (b = 0; b < QUICK_BINS; b++) {
+	while ((bp = QUICK_LIST(b)) != NULL) {
+	    SET_QUICK_LIST(b, NEXT_FREE(bp));
+	    heap_free(bp);
+	}
+    }
+    quick_count = 0;
 }
 
 /*
- * mm_realloc - mm_malloc 및 mm_free를 단순히 활용하여 구현
+ * mmap_malloc - map pages for a large request. Needs no lock.
+ */
+static void *mmap_malloc(size_t size)
+{
+    size_t pagesize = mem_pagesize();
+    size_t len = (size + MMAP_OVERHEAD + pagesize - 1) & ~(pagesize - 1);
+    char *m, *bp;
+
+    if ((m = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+	return NULL;
+    bp = m + MMAP_OVERHEAD;
+    MMAP_LEN(bp) = len;
+    PUT(HDRP(bp), PACK(0, 1 | MMAPPED));
+    return bp;
+}
+
+static void mmap_free(void *bp)
+{
+    munmap((char *)bp - MMAP_OVERHEAD, MMAP_LEN(bp));
+}
+
+/*
+ * heap_trim - give the pages inside the free block bp back to the OS.
+ * The first page (header, links) and the last (footer) stay mapped;
+ * the rest read back as zeros once the block is used again. Pages past
+ * heap_dirty are still released from the last trim, and fewer than
+ * TRIM_THRESHOLD bytes of used pages are kept, so malloc/free churn at
+ * the end of the heap does not pay a madvise and page faults each time.
+ */
+static void heap_trim(void *bp)
+{
+    size_t pagesize = mem_pagesize();
+    size_t start = ((size_t)bp + DSIZE + pagesize - 1) & ~(pagesize - 1);
+    size_t end = (size_t)FTRP(bp) & ~(pagesize - 1);
+
+    if ((size_t)heap_dirty < end)
+	end = ((size_t)heap_dirty + pagesize - 1) & ~(pagesize - 1);
+    if (start < end && end - start >= TRIM_THRESHOLD) {
+	madvise((void *)start, end - start, MADV_DONTNEED);
+	heap_dirty = (char *)start;
+    }
+}
+
+/* heap_touch - the heap is in use up to end; caller holds heap_lock */
+static void heap_touch(void *end)
+{
+    if ((char *)end > heap_dirty)
+	heap_dirty = end;
+}
+
+/*
+ * slab_malloc - take an object of class c: a freed one if there is any,
+ * otherwise the next one from the bump pointer. Caller holds heap_lock.
+ */
+static void *slab_malloc(int c)
+{
+    slab_t *s = SLAB_LIST(c);
+    char *bp;
+
+    if (s == NULL && (s = slab_new(c)) == NULL)
+	return NULL;
+    if ((bp = s->free) != NULL) {
+	s->free = *(char **)bp;
+    } else {
+	bp = s->bump;
+	s->bump += s->objsize;
+    }
+    if (++s->inuse == s->capacity)
+	slab_unlink(s, c); /* Full, nothing left to hand out */
+    return bp;
+}
+
+/*
+ * slab_free - return an object to its slab. An empty slab goes to the
+ * page list unless it is the last one of its class, which is kept to
+ * avoid thrashing. Caller holds heap_lock.
+ */
+static void slab_free(void *bp)
+{
+    slab_t *s = SLAB_OF(bp);
+    int c = SLAB_CLASS(s->objsize);
+
+    if (s->inuse-- == s->capacity)
+	slab_link(s, c);
+    if (s->inuse == 0 && (s->next != NULL || s->prev != NULL)) {
+	slab_unlink(s, c);
+	page_free(s);
+	return;
+    }
+    *(char **)bp = s->free;
+    s->free = bp;
+}
+
+/*
+ * slab_new - carve a page into objects of class c. Pages come from the
+ * page list, refilled with an aligned run of SLAB_RUN pages split into
+ * SLAB_SIZE blocks; only the alignment lead of each run is lost.
+ */
+static slab_t *slab_new(int c)
+{
+    slab_t *s;
+    char *run, *bp;
+    int i;
+
+    if (FREE_PAGES == NULL) {
+	if ((run = heap_memalign(SLAB_SIZE, SLAB_RUN * SLAB_SIZE)) == NULL)
+	    return NULL;
+	/* Growing the map for the last page covers the whole run */
+	if (pagemap_set(run + (SLAB_RUN - 1) * SLAB_SIZE, 1) < 0) {
+	    heap_free(run);
+	    return NULL;
+	}
+	for (i = SLAB_RUN - 1; i >= 0; i--) {
+	    bp = run + i * SLAB_SIZE;
+	    PUT(HDRP(bp), PACK(SLAB_SIZE, 1 | (i > 0 ? PREV_ALLOC : GET_PREV_ALLOC(HDRP(bp)))));
+	    pagemap_set(bp, 1);
+	    page_free((slab_t *)bp);
+	}
+    }
+    s = FREE_PAGES;
+    SET_FREE_PAGES(s->next);
+
+    s->objsize = (c + 1) * ALIGNMENT;
+    s->free = NULL;
+    s->bump = (char *)s + ALIGN(sizeof(slab_t));
+    s->inuse = 0;
+    s->capacity = (SLAB_SIZE - WSIZE - ALIGN(sizeof(slab_t))) / s->objsize; /* The next block's header ends the page */
+    slab_link(s, c);
+    return s;
+}
+
+/* page_free - keep an unused page for the next slab, or give it back past SLAB_RUN */
+static void page_free(slab_t *s)
+{
+    int n = (FREE_PAGES != NULL) ? FREE_PAGES->inuse : 0;
+
+    if (n >= SLAB_RUN) {
+	pagemap_set(s, 0);
+	heap_free(s);
+	return;
+    }
+    s->next = FREE_PAGES;
+    s->inuse = n + 1;
+    SET_FREE_PAGES(s);
+}
+
+static void slab_link(slab_t *s, int c)
+{
+    s->prev = NULL;
+    s->next = SLAB_LIST(c);
+    if (s->next != NULL)
+	s->next->prev = s;
+    SET_SLAB_LIST(c, s);
+}
+
+static void slab_unlink(slab_t *s, int c)
+{
+    if (s->prev != NULL)
+	s->prev->next = s->next;
+    else
+	SET_SLAB_LIST(c, s->next);
+    if (s->next != NULL)
+	s->next->prev = s->prev;
+    s->next = s->prev = NULL;
+}
+
+/*
+ * is_slab - whether bp is a slab object. Safe without heap_lock: the
+ * page of a live object cannot change, and page maps are never freed
+ * while other threads may still be reading them.
+ */
+static int is_slab(void *bp)
+{
+    pagemap_t *pm = __atomic_load_n(&pagemap, __ATOMIC_ACQUIRE);
+    size_t page = PAGE_OF(bp);
+
+    return pm != NULL && page < pm->len && pm->map[page];
+}
+
+/* pagemap_set - mark the page of bp, growing the map if needed; -1 if out of memory */
+static int pagemap_set(void *bp, int val)
+{
+    size_t page = PAGE_OF(bp);
+    size_t len;
+    pagemap_t *pm = pagemap, *npm;
+
+    if (pm == NULL || page >= pm->len) {
+	len = MAX(page + 1, pm != NULL ? 2 * pm->len : PAGEMAP_MIN);
+	if ((npm = heap_malloc(BLOCK_SIZE(sizeof(pagemap_t) + len))) == NULL)
+	    return -1;
+	npm->len = len;
+	memset(npm->map, 0, len);
+	if (pm != NULL)
+	    memcpy(npm->map, pm->map, pm->len);
+	__atomic_store_n(&pagemap, npm, __ATOMIC_RELEASE);
+#ifndef MM_THREADS
+	if (pm != NULL)
+	    heap_free(pm);
+#endif
+    }
+    pagemap->map[page] = val;
+    return 0;
+}
+
+/*
+ * mm_realloc - 가능하면 제자리에서 크기를 바꾼다.
+ *     줄이면 꼬리를 빈 블록으로 돌려주고, 늘리면 뒤의 빈 블록, 힙 끝 확장,
+ *     앞의 빈 블록 순으로 시도한 뒤에야 새로 할당하여 복사한다.
  */
 void *mm_realloc(void *ptr, size_t size) {
-    size_t old_size;
-    size_t newsize;
+    void *newp;
     
     // 포인터가 NULL인 경우 mm_malloc 호출
     if (ptr == NULL)
@@ -177,115 +836,465 @@ void *mm_realloc(void *ptr, size_t size) {
         mm_free(ptr);
         return NULL;
     }
+
+#ifdef MM_STATS
+    STAT_ADD(reallocs, 1);
+    stats_live(ptr, -1);
+#endif
+    newp = realloc_block(ptr, size);
+#ifdef MM_STATS
+    if (newp != NULL && newp != ptr)
+        STAT_ADD(realloc_moves, 1);
+    stats_live(newp != NULL ? newp : ptr, 1);
+    stats_op();
+#endif
+    return newp;
+}
+
+static void *realloc_block(void *ptr, size_t size) {
+    size_t old_size;
+    size_t newsize;
+    void *newp = NULL;
+
+    // 따로 매핑된 큰 블록은 매핑째로 늘리거나 줄이고, 작아지면 힙으로 옮긴다
+    if (!is_slab(ptr) && IS_MMAPPED(HDRP(ptr))) {
+        old_size = MMAP_LEN(ptr) - MMAP_OVERHEAD;
+        if (USE_MMAP(size)) {
+            size_t pagesize = mem_pagesize();
+            size_t len = (size + MMAP_OVERHEAD + pagesize - 1) & ~(pagesize - 1);
+            char *m = mremap((char *)ptr - MMAP_OVERHEAD, MMAP_LEN(ptr), len, MREMAP_MAYMOVE);
+
+            if (m == MAP_FAILED)
+                return NULL;
+            newp = m + MMAP_OVERHEAD;
+            MMAP_LEN(newp) = len;
+            return newp;
+        }
+        if ((newp = alloc_block(size)) != NULL) {
+            memcpy(newp, ptr, MIN(size, old_size));
+            mmap_free(ptr);
+        }
+        return newp;
+    }
+
+    // slab 객체는 크기가 고정되어 있으므로 들어가지 않으면 새로 할당하여 복사
+    if (is_slab(ptr)) {
+        old_size = SLAB_OF(ptr)->objsize;
+        if (size <= old_size)
+            return ptr;
+        if ((newp = alloc_block(size)) != NULL) {
+            memcpy(newp, ptr, old_size);
+            free_block(ptr);
+        }
+        return newp;
+    }
     
     // 이전 크기와 새로운 크기 조정
+    HEAP_LOCK();
     old_size = GET_SIZE(HDRP(ptr));
     
     // 오버헤드와 정렬 요구 사항을 포함한 블록 크기 조정
-    if (size <= DSIZE)
-        newsize = DSIZE + DSIZE;
-    else
-        newsize = DSIZE * ((size + (DSIZE) + (DSIZE-1)) / DSIZE);
+    newsize = BLOCK_SIZE(size);
     
-    // 새로운 크기가 이전 크기보다 작은 경우 기존 포인터 반환
-    if (newsize <= old_size)
+    // 줄어드는 경우 남는 꼬리를 잘라 빈 블록으로 돌려준다
+    if (newsize <= old_size) {
+        trim_block(ptr, newsize);
+        HEAP_UNLOCK();
         return ptr;
+    }
     
-    void *newp = NULL;
     void *next = NEXT_BLKP(ptr);
-    size_t next_size = GET_SIZE(HDRP(next));
+    size_t next_size = GET_ALLOC(HDRP(next)) ? 0 : GET_SIZE(HDRP(next));
+    
+    // 힙의 마지막 블록이면 모자란 만큼만 힙을 늘려서 제자리에서 키운다
+    if (old_size + next_size < newsize &&
+        GET_SIZE(HDRP(next_size ? NEXT_BLKP(next) : next)) == 0) {
+        if (extend_heap(MAX(newsize - old_size - next_size, MIN_BLOCK) / WSIZE) == NULL) {
+            HEAP_UNLOCK();
+            return NULL;
+        }
+        next_size = GET_SIZE(HDRP(next));
+    }
     
     // 인접한 빈 블록 사용 가능한 경우 크기 조절하고 기존 포인터 반환
-    if (!GET_ALLOC(HDRP(next)) && (old_size + next_size >= newsize)) {
+    if (old_size + next_size >= newsize) {
         delete_free(next);
-        PUT(HDRP(ptr), PACK(old_size + next_size, 1));
-        PUT(FTRP(ptr), PACK(old_size + next_size, 1));
-        newp = ptr;
-    } else {
-        // 새로운 크기로 mm_malloc 호출하여 메모리 블록 할당
-        if ((newp = mm_malloc(newsize)) == NULL) {
-            printf("ERROR: mm_malloc failed in mm_realloc\n");
-            exit(1);
-        }
-        place(newp, newsize);
+        PUT(HDRP(ptr), PACK(old_size + next_size, 1 | GET_PREV_ALLOC(HDRP(ptr))));
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(ptr)));
+        trim_block(ptr, newsize);
+        HEAP_UNLOCK();
+        return ptr;
+    }
+    
+    // 앞의 빈 블록까지 합치면 들어가는 경우, 데이터를 앞으로 옮긴다 (겹치므로 memmove)
+    if (!GET_PREV_ALLOC(HDRP(ptr))) {
+        void *prev = PREV_BLKP(ptr);
+        size_t total = GET_SIZE(HDRP(prev)) + old_size + next_size;
         
-        // 이전 데이터 복사 후 기존 포인터 해제
-        memcpy(newp, ptr, old_size - SIZE_T_SIZE);
-        mm_free(ptr);
+        if (total >= newsize) {
+            delete_free(prev);
+            if (next_size)
+                delete_free(next);
+            PUT(HDRP(prev), PACK(total, 1 | GET_PREV_ALLOC(HDRP(prev))));
+            SET_PREV_ALLOC(HDRP(NEXT_BLKP(prev)));
+            memmove(prev, ptr, old_size - WSIZE);
+            trim_block(prev, newsize);
+            HEAP_UNLOCK();
+            return prev;
+        }
+    }
+    
+    // 새로운 블록을 할당하고 이전 데이터 복사 후 기존 블록 해제 (충분히 크면 따로 매핑)
+    if ((newp = USE_MMAP(size) ? mmap_malloc(size) : heap_malloc(newsize)) != NULL) {
+        memcpy(newp, ptr, old_size - WSIZE);
+        heap_free(ptr);
     }
+    HEAP_UNLOCK();
     
     return newp;
 }
 
+#ifdef MM_THREADS
+/*
+ * tcache_malloc - take a block from a bin of this thread's cache: a
+ * heap block of exactly asize, or an object of one slab class.
+ * An empty bin is refilled with TCACHE_BATCH blocks under one lock.
+ * A block can come back slightly larger than asize when place() did
+ * not split it; such blocks are cached under their own size, or go
+ * straight back to the heap if that size has no bin.
+ */
+static void *tcache_malloc(int bin, size_t asize)
+{
+    tcache_t *tc;
+    char *bp, *extra;
+    int i, b, slab = (bin >= TCACHE_BINS);
 
+    if ((tc = tcache_get()) != NULL && (bp = tc->bins[bin]) != NULL) {
+	tc->bins[bin] = TC_NEXT(bp);
+	tc->count[bin]--;
+	return bp;
+    }
+
+    HEAP_LOCK();
+    bp = slab ? slab_malloc(bin - TCACHE_BINS) : heap_malloc(asize);
+    for (i = 1; tc != NULL && bp != NULL && i < TCACHE_BATCH; i++) {
+	if ((extra = slab ? slab_malloc(bin - TCACHE_BINS) : heap_malloc(asize)) == NULL)
+	    break;
+	b = slab ? bin : TC_BIN(GET_SIZE(HDRP(extra)));
+	if (b >= TCACHE_BINS && !slab) {
+	    heap_free(extra);
+	    break;
+	}
+	TC_NEXT(extra) = tc->bins[b];
+	tc->bins[b] = extra;
+	tc->count[b]++;
+    }
+    HEAP_UNLOCK();
+    return bp;
+}
+
+/*
+ * tcache_free - cache a small block, 0 if there is no cache to take it.
+ * Cached blocks stay marked allocated, so they never coalesce. A block
+ * freed by another thread than the one that allocated it simply joins
+ * the freeing thread's cache: every block carries its own header or
+ * slab, so ownership never has to be tracked.
+ */
+static int tcache_free(void *bp, int bin)
+{
+    tcache_t *tc;
+
+    if ((tc = tcache_get()) == NULL)
+	return 0;
+    TC_NEXT(bp) = tc->bins[bin];
+    tc->bins[bin] = bp;
+    if (++tc->count[bin] > TCACHE_FILL)
+	tcache_flush(tc, bin, TCACHE_BATCH);
+    return 1;
+}
+
+/* tcache_flush - give n cached blocks of a bin back to the central heap */
+static void tcache_flush(tcache_t *tc, int bin, int n)
+{
+    char *bp;
+
+    HEAP_LOCK();
+    while (n-- > 0 && (bp = tc->bins[bin]) != NULL) {
+	tc->bins[bin] = TC_NEXT(bp);
+	tc->count[bin]--;
+	if (bin >= TCACHE_BINS)
+	    slab_free(bp);
+	else
+	    heap_free(bp);
+    }
+    HEAP_UNLOCK();
+}
+
+/*
+ * tcache_get - this thread's cache, created on first use. The cache
+ * itself is a heap block, so no static arrays are needed. NULL if the
+ * heap is out of memory; callers then go straight to the heap.
+ */
+static tcache_t *tcache_get(void)
+{
+    size_t asize = BLOCK_SIZE(sizeof(tcache_t));
+
+    if (tcache != NULL && tcache_epoch == heap_epoch)
+	return tcache;
+
+    pthread_once(&tcache_once, tcache_key_init);
+    HEAP_LOCK();
+    tcache = heap_malloc(asize);
+    HEAP_UNLOCK();
+    if (tcache == NULL)
+	return NULL;
+    memset(tcache, 0, sizeof(tcache_t));
+    tcache_epoch = heap_epoch;
+    pthread_setspecific(tcache_key, tcache);
+    return tcache;
+}
+
+/* tcache_destroy - at thread exit, return the cache and its blocks */
+static void tcache_destroy(void *arg)
+{
+    tcache_t *tc = arg;
+    int bin;
+
+    if (tc != tcache || tcache_epoch != heap_epoch)
+	return;
+    for (bin = 0; bin < TCACHE_BINS + SLAB_CLASSES; bin++)
+	tcache_flush(tc, bin, tc->count[bin]);
+    HEAP_LOCK();
+    heap_free(tc);
+    HEAP_UNLOCK();
+    tcache = NULL;
+}
+
+static void tcache_key_init(void)
+{
+    pthread_key_create(&tcache_key, tcache_destroy);
+}
+#endif
+
+
+#if !defined(MM_TREE) || defined(MM_STATS)
 /*
- * best_fit - 요청된 크기에 적합한 빈 블록을 빈 블록 목록에서 찾음
+ * size_class - 블록 크기가 속하는 빈 블록 목록의 번호 (트리 빌드에서는 통계에만 쓰임)
+ */
+static int size_class(size_t size) {
+    int c = 0;
+
+    while (c < NUM_CLASSES - 1 && size >= ((size_t)MIN_BLOCK << (c + 1)))
+        c++;
+    return c;
+}
+#endif
+
+#ifdef MM_TREE
+/*
+ * best_fit - 트리에서 asize 이상인 가장 작은 블록을 찾음.
+ * (asize, NULL)은 트리에 없는 키이므로 splay 후 루트는 그 바로 앞이나 뒤의 블록.
  */
 static void* best_fit(size_t asize) {
-    void *bp;
-    void *best;
-    size_t flag = 0;
-    size_t min_size = SIZE_MAX;
-    
-    for (bp = free_listp; GET_ALLOC(HDRP(bp)) == 0; bp = GET(NEXT_FREE_BLKP(bp))) {
-        // 요청된 크기를 수용 가능하면서 가장 작은 블록을 선택
-        if ((asize <= GET_SIZE(HDRP(bp))) && (GET_SIZE(HDRP(bp)) < min_size)) {
-            min_size = GET_SIZE(HDRP(bp));
-            flag = 1;
-            best = bp;
+    char *bp;
+#ifdef MM_STATS
+    unsigned long steps = 1;
+#endif
+
+    if (TREE_ROOT == NULL)
+        return NULL;
+    bp = splay(TREE_ROOT, asize, NULL);
+    SET_TREE_ROOT(bp);
+    // 루트가 더 작으면 오른쪽 서브트리의 가장 왼쪽 블록이 답
+    if (GET_SIZE(HDRP(bp)) < asize) {
+        for (bp = RIGHT(bp); bp != NULL && LEFT(bp) != NULL; bp = LEFT(bp)) {
+#ifdef MM_STATS
+            steps++;
+#endif
         }
     }
-    if (flag)
-        return best;
-    
-    return NULL;
+#ifdef MM_STATS
+    STAT_ADD(searches, 1);
+    STAT_ADD(search_steps, steps);
+    if (steps > mm_stat.search_max)
+        mm_stat.search_max = steps; /* Callers hold heap_lock */
+#endif
+    return bp;
 }
 
+/*
+ * splay - top-down splay of the tree t for the key (size, addr). The
+ * block with that key, or the one just before or after it, becomes the
+ * root, which is returned.
+ */
+static char *splay(char *t, size_t size, char *addr)
+{
+    char *l_root = NULL, *l_max = NULL; /* Blocks less than the key */
+    char *r_root = NULL, *r_min = NULL; /* Blocks greater than the key */
+    char *y;
 
-static void insert_free(void *bp) {
-	// 'bp'의 이전 빈 블록 포인터를 NULL로 설정
-	PUT(PREV_FREE_BLKP(bp), NULL);
-	// 현재 빈 블록 리스트의 첫 번째 블록의 이전 빈 블록 포인터를 'bp'로 설정
-	PUT(PREV_FREE_BLKP(free_listp), bp);
+    if (t == NULL)
+	return NULL;
+    for (;;) {
+	if (KEY_LT(size, addr, t)) {
+	    if ((y = LEFT(t)) == NULL)
+		break;
+	    if (KEY_LT(size, addr, y)) { /* Rotate right */
+		SET_LEFT(t, RIGHT(y));
+		SET_RIGHT(y, t);
+		t = y;
+		if (LEFT(t) == NULL)
+		    break;
+	    }
+	    if (r_min == NULL) /* Link right */
+		r_root = t;
+	    else
+		SET_LEFT(r_min, t);
+	    r_min = t;
+	    t = LEFT(t);
+	} else if (KEY_GT(size, addr, t)) {
+	    if ((y = RIGHT(t)) == NULL)
+		break;
+	    if (KEY_GT(size, addr, y)) { /* Rotate left */
+		SET_RIGHT(t, LEFT(y));
+		SET_LEFT(y, t);
+		t = y;
+		if (RIGHT(t) == NULL)
+		    break;
+	    }
+	    if (l_max == NULL) /* Link left */
+		l_root = t;
+	    else
+		SET_RIGHT(l_max, t);
+	    l_max = t;
+	    t = RIGHT(t);
+	} else {
+	    break;
+	}
+    }
+    /* Assemble */
+    if (l_max != NULL) {
+	SET_RIGHT(l_max, LEFT(t));
+	SET_LEFT(t, l_root);
+    }
+    if (r_min != NULL) {
+	SET_LEFT(r_min, RIGHT(t));
+	SET_RIGHT(t, r_root);
+    }
+    return t;
+}
 
-	// 'bp'의 다음 빈 블록 포인터를 현재 빈 블록 리스트의 첫 번째 블록으로 설정
-	PUT(NEXT_FREE_BLKP(bp), free_listp);
+static void insert_free(void *bp) {
+	size_t size = GET_SIZE(HDRP(bp));
+	char *t = TREE_ROOT;
 
-	// 'bp'를 새로운 빈 블록 리스트의 첫 번째 블록으로 설정
-	free_listp = bp;
+	// 새 키 바로 옆 블록을 루트로 올린 뒤 그 위에 'bp'를 새 루트로 얹음
+	if (t == NULL) {
+		SET_LEFT(bp, NULL);
+		SET_RIGHT(bp, NULL);
+	} else {
+		t = splay(t, size, bp);
+		if (KEY_LT(size, bp, t)) {
+			SET_LEFT(bp, LEFT(t));
+			SET_RIGHT(bp, t);
+			SET_LEFT(t, NULL);
+		} else {
+			SET_RIGHT(bp, RIGHT(t));
+			SET_LEFT(bp, t);
+			SET_RIGHT(t, NULL);
+		}
+	}
+	SET_TREE_ROOT(bp);
 }
 
 static void delete_free(void *bp) {
-	// 'bp'의 이전 빈 블록 포인터를 가져옴
-	char *prev = GET(PREV_FREE_BLKP(bp));
-	// 'bp'의 다음 빈 블록 포인터를 가져옴
-	char *next = GET(NEXT_FREE_BLKP(bp));
-
-	// 이전 빈 블록 포인터가 NULL인 경우
-	if (!prev) {
-		// 'bp'를 새로운 빈 블록 리스트의 첫 번째 블록으로 설정
-		free_listp = next;
-		
-		// 다음 빈 블록의 이전 빈 블록 포인터를 NULL로 설정
-		PUT(PREV_FREE_BLKP(next), NULL);
+	size_t size = GET_SIZE(HDRP(bp));
+	char *t = splay(TREE_ROOT, size, bp); /* t == bp */
+
+	// 왼쪽 서브트리의 가장 큰 블록을 루트로 올리면 그 오른쪽이 비므로 오른쪽 서브트리를 붙임
+	if (LEFT(t) == NULL) {
+		SET_TREE_ROOT(RIGHT(t));
+	} else {
+		char *l = splay(LEFT(t), size, bp);
+
+		SET_RIGHT(l, RIGHT(t));
+		SET_TREE_ROOT(l);
 	}
-	else {
-		// 이전 빈 블록의 다음 빈 블록 포인터를 'next'로 설정
-		PUT(NEXT_FREE_BLKP(prev), next);
-		
-		// 다음 빈 블록의 이전 빈 블록 포인터를 'prev'로 설정
-		PUT(PREV_FREE_BLKP(next), prev);
+}
+#else
+/*
+ * best_fit - 요청된 크기에 적합한 빈 블록을 size class별 빈 블록 목록에서 찾음.
+ * 각 목록은 크기순으로 정렬되어 있으므로 처음 맞는 블록이 가장 작은 블록.
+ */
+static void* best_fit(size_t asize) {
+    int c;
+    char *bp = NULL;
+#ifdef MM_STATS
+    unsigned long steps = 0;
+#endif
+
+    for (c = size_class(asize); c < NUM_CLASSES && bp == NULL; c++) {
+        for (bp = SEG_LIST(c); bp != NULL; bp = NEXT_FREE(bp)) {
+#ifdef MM_STATS
+            steps++;
+#endif
+            if (asize <= GET_SIZE(HDRP(bp)))
+                break;
+        }
+    }
+#ifdef MM_STATS
+    STAT_ADD(searches, 1);
+    STAT_ADD(search_steps, steps);
+    if (steps > mm_stat.search_max)
+        mm_stat.search_max = steps; /* Callers hold heap_lock */
+#endif
+    return bp;
+}
+
+static void insert_free(void *bp) {
+	size_t size = GET_SIZE(HDRP(bp));
+	int c = size_class(size);
+	char *prev = NULL;
+	char *next = SEG_LIST(c);
+
+	// 크기순 정렬을 유지하도록 'bp'보다 작은 블록들 뒤에 삽입
+	while (next != NULL && GET_SIZE(HDRP(next)) < size) {
+		prev = next;
+		next = NEXT_FREE(next);
 	}
-return;
+
+	SET_NEXT_FREE(bp, next);
+	SET_PREV_FREE(bp, prev);
+	if (next != NULL)
+		SET_PREV_FREE(next, bp);
+	if (prev != NULL)
+		SET_NEXT_FREE(prev, bp);
+	else
+		SET_SEG_LIST(c, bp);
+}
+
+static void delete_free(void *bp) {
+	// 'bp'의 이전/다음 빈 블록 포인터를 가져옴
+	char *prev = PREV_FREE(bp);
+	char *next = NEXT_FREE(bp);
+
+	// 이전 빈 블록이 없으면 'bp'가 목록의 첫 번째 블록
+	if (prev != NULL)
+		SET_NEXT_FREE(prev, next);
+	else
+		SET_SEG_LIST(size_class(GET_SIZE(HDRP(bp))), next);
+	if (next != NULL)
+		SET_PREV_FREE(next, prev);
 }
+#endif
 
 /*
  * coalesce - 경계 태그 결합. 결합된 블록의 포인터 반환
  */
 static void *coalesce(void *bp)
 {
-    // 이전 블록이 할당되었는지 확인하고, 첫 번째 블록을 가리키는 경우 처리
-    size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp))) || PREV_BLKP(bp) == bp;
+    // 이전 블록이 할당되었는지 확인 (헤더의 PREV_ALLOC 비트, 할당된 블록에는 footer가 없음)
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
     // 다음 블록이 할당되었는지 확인
     size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
     // 현재 블록의 크기를 가져옴
@@ -303,7 +1312,7 @@ static void *coalesce(void *bp)
         // 현재 블록과 다음 블록의 크기를 결합
         size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
         // 헤더와 푸터에 결합된 크기와 할당되지 않음을 표시
-        PUT(HDRP(bp), PACK(size, 0));
+        PUT(HDRP(bp), PACK(size, PREV_ALLOC));
         PUT(FTRP(bp), PACK(size, 0));
     }
     // 이전 블록이 비어있고 다음 블록이 할당된 경우 (Case 3)
@@ -314,7 +1323,7 @@ static void *coalesce(void *bp)
         size += GET_SIZE(HDRP(PREV_BLKP(bp)));
         // 이전 블록의 헤더와 현재 블록의 푸터에 결합된 크기와 할당되지 않음을 표시
         PUT(FTRP(bp), PACK(size, 0));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
+        PUT(HDRP(PREV_BLKP(bp)), PACK(size, GET_PREV_ALLOC(HDRP(PREV_BLKP(bp)))));
         // 포인터를 이전 블록으로 옮긴다.
         bp = PREV_BLKP(bp);
     }
@@ -325,9 +1334,9 @@ static void *coalesce(void *bp)
         delete_free(PREV_BLKP(bp));
         // 현재 블록과 이전 블록, 다음 블록의 크기를 결합
         size += GET_SIZE(HDRP(PREV_BLKP(bp))) +
-            GET_SIZE(FTRP(NEXT_BLKP(bp)));
+            GET_SIZE(HDRP(NEXT_BLKP(bp)));
         // 이전 블록의 헤더와 다음 블록의 푸터에 결합된 크기와 할당되지 않음을 표시
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
+        PUT(HDRP(PREV_BLKP(bp)), PACK(size, GET_PREV_ALLOC(HDRP(PREV_BLKP(bp)))));
         PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
         // 포인터를 이전 블록으로 옮긴다.
         bp = PREV_BLKP(bp);
@@ -351,7 +1360,7 @@ static void *extend_heap(size_t words)
 	return NULL;
 
     /* Initialize free block header/footer and the epilogue header */
-    PUT(HDRP(bp), PACK(size, 0));         /* free block header */
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)))); /* free block header, over the old epilogue */
     PUT(FTRP(bp), PACK(size, 0));         /* free block footer */
     PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* new epilogue header */
 
@@ -367,34 +1376,37 @@ static void place(void *bp, size_t asize)
 	delete_free(bp);
 
 	// 현재 블록의 크기에서 할당을 위해 필요한 크기(asize)를 뺀 값이 최소 블록 크기보다 큰 경우
-	if ((csize - asize) >= (DSIZE + DSIZE)) {
-		// 현재 블록의 헤더와 푸터를 asize 크기로 설정하고 할당된 상태로 표시
-		PUT(HDRP(bp), PACK(asize, 1));
-		PUT(FTRP(bp), PACK(asize, 1));
+	if ((csize - asize) >= MIN_BLOCK) {
+		// 현재 블록의 헤더를 asize 크기로 설정하고 할당된 상태로 표시
+		PUT(HDRP(bp), PACK(asize, 1 | GET_PREV_ALLOC(HDRP(bp))));
 		
 		// 다음 블록으로 이동
 		bp = NEXT_BLKP(bp);
+		heap_touch(bp);
 		
-		// 남은 블록의 헤더와 푸터를 csize-asize 크기로 설정하고 빈 상태로 표시
-		PUT(HDRP(bp), PACK(csize-asize, 0));
+		// 남은 블록의 헤더와 푸터를 csize-asize 크기로 설정하고 빈 상태로 표시 (이전 블록은 할당됨)
+		PUT(HDRP(bp), PACK(csize-asize, PREV_ALLOC));
 		PUT(FTRP(bp), PACK(csize-asize, 0));
 		
 		// 남은 블록을 빈 블록 리스트에 삽입
 		insert_free(bp);
 	}
 	else {
-		// 현재 블록의 헤더와 푸터를 csize 크기로 설정하고 할당된 상태로 표시
-		PUT(HDRP(bp), PACK(csize, 1));
-		PUT(FTRP(bp), PACK(csize, 1));
+		// 현재 블록의 헤더를 csize 크기로 설정하고 할당된 상태로 표시, 다음 블록에 알림
+		PUT(HDRP(bp), PACK(csize, 1 | GET_PREV_ALLOC(HDRP(bp))));
+		SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+		heap_touch(NEXT_BLKP(bp));
 	}
 }
 
 static void checkblock(void *bp)
 {
-	if ((unsigned int )bp % DSIZE)
+	if ((size_t)bp % ALIGNMENT)
 		printf("Error: %p is not doubleword aligned\n", bp);
-	if (GET_SIZE(HDRP(bp)) != GET_SIZE(FTRP(bp)) || GET_ALLOC(HDRP(bp)) != GET_ALLOC(FTRP(bp)))
+	if (!GET_ALLOC(HDRP(bp)) && GET(HDRP(bp)) != (GET(FTRP(bp)) | GET_PREV_ALLOC(HDRP(bp))))
 		printf("Error: header does not match footer\n");
+	if (!GET_ALLOC(HDRP(bp)) != !GET_PREV_ALLOC(HDRP(NEXT_BLKP(bp))))
+		printf("Error: %p disagrees with the prev-alloc bit of the next block\n", bp);
 }
 
 /*
@@ -403,13 +1415,13 @@ static void checkblock(void *bp)
 int mm_check(int verbose)
 {
     char *bp = heap_listp;
+    int c;
 
     if (verbose)
 	printf("Heap (%p):\n", heap_listp);
 
     if ((GET_SIZE(HDRP(heap_listp)) != DSIZE) || !GET_ALLOC(HDRP(heap_listp)))
 	printf("Bad prologue header\n");
-    checkblock(heap_listp);
 
     for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
 	if (verbose)
@@ -421,6 +1433,43 @@ int mm_check(int verbose)
 	printblock(bp);
     if ((GET_SIZE(HDRP(bp)) != 0) || !(GET_ALLOC(HDRP(bp))))
 	printf("Bad epilogue header\n");
+
+#ifdef MM_TREE
+    /* Every free block can be found from the root, and every block met on the way is free */
+    for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+	char *t = TREE_ROOT;
+
+	if (GET_ALLOC(HDRP(bp)))
+	    continue;
+	while (t != NULL && t != bp) {
+	    if (GET_ALLOC(HDRP(t)))
+		printf("Error: %p in the free tree is allocated\n", t);
+	    t = KEY_LT(GET_SIZE(HDRP(bp)), bp, t) ? LEFT(t) : RIGHT(t);
+	}
+	if (t == NULL)
+	    printf("Error: free block %p is not in the free tree\n", bp);
+    }
+#else
+    /* Every listed block is free, in its own class and in size order */
+    for (c = 0; c < NUM_CLASSES; c++) {
+	for (bp = SEG_LIST(c); bp != NULL; bp = NEXT_FREE(bp)) {
+	    if (GET_ALLOC(HDRP(bp)))
+		printf("Error: %p in free list %d is allocated\n", bp, c);
+	    if (size_class(GET_SIZE(HDRP(bp))) != c)
+		printf("Error: %p is in free list %d, not %d\n", bp, c, size_class(GET_SIZE(HDRP(bp))));
+	    if (NEXT_FREE(bp) != NULL && GET_SIZE(HDRP(NEXT_FREE(bp))) < GET_SIZE(HDRP(bp)))
+		printf("Error: free list %d is out of order at %p\n", c, bp);
+	}
+    }
+#endif
+
+    /* Quick list blocks stay allocated and all have the list's size */
+    for (c = 0; c < QUICK_BINS; c++) {
+	for (bp = QUICK_LIST(c); bp != NULL; bp = NEXT_FREE(bp)) {
+	    if (!GET_ALLOC(HDRP(bp)) || QUICK_BIN(GET_SIZE(HDRP(bp))) != c)
+		printf("Error: %p does not belong on quick list %d\n", bp, c);
+	}
+    }
     return 1;
 }
 
@@ -430,15 +1479,178 @@ static void printblock(void *bp)
 
     hsize = GET_SIZE(HDRP(bp));
     halloc = GET_ALLOC(HDRP(bp));
-    fsize = GET_SIZE(FTRP(bp));
-    falloc = GET_ALLOC(FTRP(bp));
 
     if (hsize == 0) {
 	printf("%p: EOL\n", bp);
 	return;
     }
+    if (halloc) {
+	printf("%p: header: [%lu:a]\n", bp, (unsigned long)hsize);
+	return;
+    }
+
+    fsize = GET_SIZE(FTRP(bp));
+    falloc = GET_ALLOC(FTRP(bp));
+    printf("%p: header: [%lu:f] footer: [%lu:%c]\n", bp,
+	   (unsigned long)hsize, (unsigned long)fsize, (falloc ? 'a' : 'f'));
+}
+#ifdef MM_STATS
+/*
+ * mm_stats - print the counters, the free lists and the utilization
+ * samples. Blocks held in thread caches count as neither live nor free.
+ */
+void mm_stats(FILE *fp)
+{
+    unsigned long mallocs, nfree[NUM_CLASSES], free_bytes[NUM_CLASSES];
+    unsigned long total_free = 0, total_blocks = 0, largest = 0;
+    size_t footprint;
+    char *bp;
+    int c, i;
+
+    mallocs = mm_stat.mmap_mallocs;
+    for (c = 0; c < NUM_CLASSES; c++)
+	mallocs += mm_stat.heap_mallocs[c];
+    for (c = 0; c < SLAB_CLASSES; c++)
+	mallocs += mm_stat.slab_mallocs[c];
+    fprintf(fp, "mallocs %lu, frees %lu, reallocs %lu (%lu moved)\n",
+	    mallocs, mm_stat.frees, mm_stat.reallocs, mm_stat.realloc_moves);
+    fprintf(fp, "requested %lu bytes in %lu block bytes: internal fragmentation %.1f%%\n",
+	    mm_stat.req_bytes, mm_stat.block_bytes,
+	    mm_stat.block_bytes ? 100.0 * (mm_stat.block_bytes - mm_stat.req_bytes) / mm_stat.block_bytes : 0.0);
+    fprintf(fp, "peak live %lu, peak heap %lu, peak mapped %lu bytes\n",
+	    (unsigned long)mm_stat.live_peak, (unsigned long)mm_stat.heap_peak,
+	    (unsigned long)mm_stat.mapped_peak);
+    fprintf(fp, "best fit: %lu searches, %.2f blocks per search, %lu at most\n",
+	    mm_stat.searches,
+	    mm_stat.searches ? (double)mm_stat.search_steps / mm_stat.searches : 0.0,
+	    mm_stat.search_max);
+
+    /* The free blocks are the same whether they sit in lists or in the tree, so walk the heap */
+    memset(nfree, 0, sizeof(nfree));
+    memset(free_bytes, 0, sizeof(free_bytes));
+    HEAP_LOCK();
+    for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+	if (GET_ALLOC(HDRP(bp)))
+	    continue;
+	c = size_class(GET_SIZE(HDRP(bp)));
+	nfree[c]++;
+	free_bytes[c] += GET_SIZE(HDRP(bp));
+	largest = MAX(largest, GET_SIZE(HDRP(bp)));
+    }
+    HEAP_UNLOCK();
+    fprintf(fp, "\n%5s %21s %10s %10s %12s\n", "class", "block sizes", "mallocs", "free", "free bytes");
+    for (c = 0; c < NUM_CLASSES; c++) {
+	total_free += free_bytes[c];
+	total_blocks += nfree[c];
+	if (nfree[c] == 0 && mm_stat.heap_mallocs[c] == 0)
+	    continue;
+	if (c < NUM_CLASSES - 1)
+	    fprintf(fp, "%5d %10lu-%-10lu %10lu %10lu %12lu\n", c, (unsigned long)MIN_BLOCK << c,
+		    ((unsigned long)MIN_BLOCK << (c + 1)) - 1, mm_stat.heap_mallocs[c], nfree[c], free_bytes[c]);
+	else
+	    fprintf(fp, "%5d %10lu+%10s %10lu %10lu %12lu\n", c, (unsigned long)MIN_BLOCK << c, "",
+		    mm_stat.heap_mallocs[c], nfree[c], free_bytes[c]);
+    }
+    for (c = 0; c < SLAB_CLASSES; c++)
+	if (mm_stat.slab_mallocs[c] != 0)
+	    fprintf(fp, "%5s %21d %10lu\n", "slab", (c + 1) * ALIGNMENT, mm_stat.slab_mallocs[c]);
+    if (mm_stat.mmap_mallocs != 0)
+	fprintf(fp, "%5s %10d+%10s %10lu\n", "mmap", MMAP_THRESHOLD, "", mm_stat.mmap_mallocs);
+    fprintf(fp, "free: %lu bytes in %lu blocks, largest %lu: external fragmentation %.1f%%\n",
+	    total_free, total_blocks, largest,
+	    total_free ? 100.0 * (total_free - largest) / total_free : 0.0);
+    fprintf(fp, "quick lists: %d blocks waiting to be coalesced\n", quick_count);
+
+    fprintf(fp, "\n%10s %12s %12s %12s %6s\n", "ops", "heap", "mapped", "live", "util");
+    for (i = 0; i < mm_stat.nsamples; i++) {
+	stats_sample_t *sp = &mm_stat.samples[i];
+
+	footprint = sp->heap + sp->mapped;
+	fprintf(fp, "%10lu %12lu %12lu %12lu %5.1f%%\n", sp->ops, (unsigned long)sp->heap,
+		(unsigned long)sp->mapped, (unsigned long)sp->live,
+		footprint ? 100.0 * sp->live / footprint : 0.0);
+    }
+}
+
+/* stats_malloc - count a new block by the allocator that served it */
+static void stats_malloc(void *bp, size_t size)
+{
+    if (is_slab(bp))
+	STAT_ADD(slab_mallocs[SLAB_CLASS(SLAB_OF(bp)->objsize)], 1);
+    else if (IS_MMAPPED(HDRP(bp)))
+	STAT_ADD(mmap_mallocs, 1);
+    else
+	STAT_ADD(heap_mallocs[size_class(GET_SIZE(HDRP(bp)))], 1);
+    STAT_ADD(req_bytes, size);
+    STAT_ADD(block_bytes, stats_size(bp));
+    stats_live(bp, 1);
+    stats_op();
+}
+
+/* stats_live - add (sign 1) or take away (sign -1) a block the caller holds */
+static void stats_live(void *bp, int sign)
+{
+    size_t size = stats_size(bp);
+
+    if (sign > 0) {
+	stats_max(&mm_stat.live_peak, __atomic_add_fetch(&mm_stat.live, size, __ATOMIC_RELAXED));
+	if (!is_slab(bp) && IS_MMAPPED(HDRP(bp)))
+	    stats_max(&mm_stat.mapped_peak, __atomic_add_fetch(&mm_stat.mapped, size, __ATOMIC_RELAXED));
+    } else {
+	__atomic_sub_fetch(&mm_stat.live, size, __ATOMIC_RELAXED);
+	if (!is_slab(bp) && IS_MMAPPED(HDRP(bp)))
+	    __atomic_sub_fetch(&mm_stat.mapped, size, __ATOMIC_RELAXED);
+    }
+    stats_max(&mm_stat.heap_peak, mem_heapsize());
+}
+
+/* stats_op - count a malloc, free or realloc; every so often record a utilization sample */
+static void stats_op(void)
+{
+    unsigned long ops;
+    stats_sample_t *sp;
+    int i;
+
+    ops = __atomic_add_fetch(&mm_stat.ops, 1, __ATOMIC_RELAXED);
+    if (ops % __atomic_load_n(&mm_stat.interval, __ATOMIC_RELAXED) != 0)
+	return;
+#ifdef MM_THREADS
+    pthread_mutex_lock(&stats_lock);
+#endif
+    /* Full: keep every other sample and sample half as often */
+    if (mm_stat.nsamples == STATS_SAMPLES) {
+	for (i = 0; i < STATS_SAMPLES / 2; i++)
+	    mm_stat.samples[i] = mm_stat.samples[2 * i + 1];
+	mm_stat.nsamples = STATS_SAMPLES / 2;
+	__atomic_store_n(&mm_stat.interval, mm_stat.interval * 2, __ATOMIC_RELAXED);
+    }
+    if (ops % mm_stat.interval == 0) {
+	sp = &mm_stat.samples[mm_stat.nsamples++];
+	sp->ops = ops;
+	sp->heap = mem_heapsize();
+	sp->mapped = mm_stat.mapped;
+	sp->live = mm_stat.live;
+    }
+#ifdef MM_THREADS
+    pthread_mutex_unlock(&stats_lock);
+#endif
+}
 
-    printf("%p: header: [%ld:%c] footer: [%ld:%c]\n", bp,
-	   hsize, (halloc ? 'a' : 'f'),
-	   fsize, (falloc ? 'a' : 'f'));
-}
\ No newline at end of file
+/* stats_size - bytes the block takes: slab object, mapping or heap block */
+static size_t stats_size(void *bp)
+{
+    if (is_slab(bp))
+	return SLAB_OF(bp)->objsize;
+    if (IS_MMAPPED(HDRP(bp)))
+	return MMAP_LEN(bp);
+    return GET_SIZE(HDRP(bp));
+}
+
+static void stats_max(size_t *p, size_t val)
+{
+    size_t old = __atomic_load_n(p, __ATOMIC_RELAXED);
+
+    while (val > old && !__atomic_compare_exchange_n(p, &old, val, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	;
+}
+#endif